@@ -9,6 +9,18 @@
 #include <getopt.h>
 #include <signal.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define SEARCH_SLICE (256UL << 10)  // bytes per step: the automaton re-reads them from cache
+#define MAX_NEEDLES 8               // searchers fused into one pass
+#define AC_OUT (1U << 31)           // transition flag: the target state matches something
+#define AC_ROW (AC_OUT - 1)         // transition value: row offset of the target state
 
 volatile sig_atomic_t stopFlag = 0;
 
@@ -17,26 +29,378 @@ void handle_sigint(int signo) {
     printf("\n[!] Program interrupted. Cleaning up...\n");
 }
 
+// ====== SUBSTRING SEARCH ======
+// Counts the occurrences of a needle, overlapping ones included. Candidate
+// offsets are found a vector at a time by comparing the first and the last
+// byte of the needle against 32 (or 16) offsets at once; only where both
+// match is the middle compared. Horspool's algorithm handles the tail
+// that is too short for a vector, and CPUs without SIMD.
+typedef struct {
+    const char *needle;
+    size_t len;
+    size_t shift[256];      // Horspool: how far the last window byte moves us
+} Searcher;
+
+// Add to counts[i] the matches of needles[i] that start in [from, to),
+// reading no further than size
+typedef void (*count_fn)(const Searcher *needles, int n, const char *data,
+                         size_t from, size_t to, size_t size, long *counts);
+
+void searcher_init(Searcher *s, const char *needle) {
+    s->needle = needle;
+    s->len = strlen(needle);
+    for (int c = 0; c < 256; c++)
+        s->shift[c] = s->len ? s->len : 1;
+    for (size_t i = 0; i + 1 < s->len; i++)
+        s->shift[(unsigned char)needle[i]] = s->len - 1 - i;
+}
+
+long horspool(const Searcher *s, const char *data, size_t from, size_t to, size_t size) {
+    size_t m = s->len;
+    long n = 0;
+    if (m == 0) return to > from ? (long)(to - from) : 0;
+
+    size_t limit = to + m - 1 < size ? to + m - 1 : size;    // last byte a match may use
+    for (size_t p = from; p + m <= limit; ) {
+        unsigned char c = data[p + m - 1];
+        if (c == (unsigned char)s->needle[m - 1] && memcmp(data + p, s->needle, m - 1) == 0)
+            n++;
+        p += s->shift[c];
+    }
+    return n;
+}
+
+void count_horspool(const Searcher *needles, int n, const char *data,
+                    size_t from, size_t to, size_t size, long *counts) {
+    for (int i = 0; i < n; i++)
+        counts[i] += horspool(&needles[i], data, from, to, size);
+}
+
+// Longest needle, or 0 if one is empty (the vector loops skip those)
+size_t vector_reach(const Searcher *needles, int n) {
+    size_t reach = 1;
+    for (int i = 0; i < n; i++) {
+        if (needles[i].len == 0) return 0;
+        if (needles[i].len > reach) reach = needles[i].len;
+    }
+    return reach;
+}
+
+// The needles are fused into one loop: every vector of text is loaded
+// once and tested against all of them while it is in registers.
+// Single-byte needles (the newline) are counted with a popcount.
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void count_sse2(const Searcher *needles, int n, const char *data,
+                size_t from, size_t to, size_t size, long *counts) {
+    size_t reach = vector_reach(needles, n), p = from;
+    __m128i first[MAX_NEEDLES], last[MAX_NEEDLES];
+    for (int i = 0; i < n && reach; i++) {
+        first[i] = _mm_set1_epi8(needles[i].needle[0]);
+        last[i] = _mm_set1_epi8(needles[i].needle[needles[i].len - 1]);
+    }
+
+    for (; reach && p + 16 <= to && p + 16 + reach - 1 <= size; p += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + p));
+        for (int i = 0; i < n; i++) {
+            size_t m = needles[i].len;
+            __m128i b = m == 1 ? a : _mm_loadu_si128((const __m128i *)(data + p + m - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first[i]),
+                                                            _mm_cmpeq_epi8(b, last[i])));
+            if (m <= 2) {
+                counts[i] += __builtin_popcount(mask);
+                continue;
+            }
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (memcmp(data + p + bit + 1, needles[i].needle + 1, m - 2) == 0) counts[i]++;
+                mask &= mask - 1;
+            }
+        }
+    }
+    count_horspool(needles, n, data, p, to, size, counts);
+}
+
+__attribute__((target("avx2,popcnt")))
+void count_avx2(const Searcher *needles, int n, const char *data,
+                size_t from, size_t to, size_t size, long *counts) {
+    size_t reach = vector_reach(needles, n), p = from;
+    __m256i first[MAX_NEEDLES], last[MAX_NEEDLES];
+    for (int i = 0; i < n && reach; i++) {
+        first[i] = _mm256_set1_epi8(needles[i].needle[0]);
+        last[i] = _mm256_set1_epi8(needles[i].needle[needles[i].len - 1]);
+    }
+
+    for (; reach && p + 32 <= to && p + 32 + reach - 1 <= size; p += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + p));
+        for (int i = 0; i < n; i++) {
+            size_t m = needles[i].len;
+            __m256i b = m == 1 ? a : _mm256_loadu_si256((const __m256i *)(data + p + m - 1));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first[i]),
+                                                                             _mm256_cmpeq_epi8(b, last[i])));
+            if (m <= 2) {
+                counts[i] += __builtin_popcount(mask);
+                continue;
+            }
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (memcmp(data + p + bit + 1, needles[i].needle + 1, m - 2) == 0) counts[i]++;
+                mask &= mask - 1;
+            }
+        }
+    }
+    count_horspool(needles, n, data, p, to, size, counts);
+}
+#endif
+
+// Pick the widest kernel the CPU supports
+count_fn select_search(const char **name) {
+    *name = "horspool";
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        *name = "avx2";
+        return count_avx2;
+    }
+    *name = "sse2";
+    return count_sse2;
+#endif
+    return count_horspool;
+}
+
+// ====== MULTI-PATTERN SEARCH (AHO-CORASICK) ======
+// All keywords are compiled into one DFA so a single pass counts them all.
+// Bytes that appear in no keyword share column 0 (and with -i both cases
+// of a letter share a column), which keeps the table narrow: row s holds
+// nclasses transitions, each the row offset of the next state, so the
+// inner loop is one load and an add. AC_OUT marks states that end a
+// match; the scan only counts visits to those, and ac_tally walks their
+// dictionary links afterwards to turn visits into per-keyword counts.
+typedef struct {
+    uint32_t *delta;        // nstates * nclasses transitions
+    uint16_t cls[256];      // byte -> column
+    int nclasses;
+    int nstates;
+    int *pattern;           // keyword ending at each state, -1 if none
+    int *dict;              // next state on the fail chain ending a keyword, -1 if none
+    int *alias;             // keyword whose count each keyword shares, -1 if empty
+    size_t maxlen;
+} Automaton;
+
+void ac_free(Automaton *ac) {
+    free(ac->delta);
+    free(ac->pattern);
+    free(ac->dict);
+    free(ac->alias);
+}
+
+// Returns -1 if memory runs out or the table would not fit in AC_ROW
+int ac_build(Automaton *ac, char **pats, int n, int nocase) {
+    memset(ac, 0, sizeof(*ac));
+
+    size_t total = 1;
+    ac->nclasses = 1;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(pats[i]);
+        total += len;
+        if (len > ac->maxlen) ac->maxlen = len;
+        for (size_t j = 0; j < len; j++) {
+            unsigned char c = pats[i][j];
+            if (nocase) c = tolower(c);
+            if (!ac->cls[c]) ac->cls[c] = ac->nclasses++;
+        }
+    }
+    if (nocase)
+        for (int c = 'A'; c <= 'Z'; c++)
+            ac->cls[c] = ac->cls[tolower(c)];
+
+    size_t ncls = ac->nclasses;
+    if (total * ncls > AC_ROW) return -1;
+
+    int *go = malloc(total * ncls * sizeof(int));
+    int *fail = malloc(total * sizeof(int));
+    int *queue = malloc(total * sizeof(int));
+    ac->delta = malloc(total * ncls * sizeof(uint32_t));
+    ac->pattern = malloc(total * sizeof(int));
+    ac->dict = malloc(total * sizeof(int));
+    ac->alias = malloc((n ? n : 1) * sizeof(int));
+    if (!go || !fail || !queue || !ac->delta || !ac->pattern || !ac->dict || !ac->alias) {
+        free(go);
+        free(fail);
+        free(queue);
+        ac_free(ac);
+        return -1;
+    }
+
+    // ====== TRIE ======
+    memset(go, -1, ncls * sizeof(int));
+    ac->pattern[0] = -1;
+    ac->nstates = 1;
+    for (int i = 0; i < n; i++) {
+        int s = 0;
+        for (const char *c = pats[i]; *c; c++) {
+            int *next = &go[s * ncls + ac->cls[(unsigned char)*c]];
+            if (*next < 0) {
+                *next = ac->nstates++;
+                memset(&go[*next * ncls], -1, ncls * sizeof(int));
+                ac->pattern[*next] = -1;
+            }
+            s = *next;
+        }
+        if (s == 0)
+            ac->alias[i] = -1;
+        else if (ac->pattern[s] < 0)
+            ac->alias[i] = ac->pattern[s] = i;
+        else
+            ac->alias[i] = ac->pattern[s];
+    }
+
+    // ====== FAIL LINKS + DFA (breadth first) ======
+    int head = 0, tail = 0;
+    fail[0] = 0;
+    ac->dict[0] = -1;
+    for (size_t c = 0; c < ncls; c++) {
+        int t = go[c];
+        if (t < 0) {
+            ac->delta[c] = 0;
+            continue;
+        }
+        fail[t] = 0;
+        ac->dict[t] = -1;
+        queue[tail++] = t;
+        ac->delta[c] = t * ncls | (ac->pattern[t] >= 0 ? AC_OUT : 0);
+    }
+    while (head < tail) {
+        int s = queue[head++];
+        for (size_t c = 0; c < ncls; c++) {
+            int t = go[s * ncls + c];
+            if (t < 0) {
+                ac->delta[s * ncls + c] = ac->delta[fail[s] * ncls + c];
+                continue;
+            }
+            int f = (ac->delta[fail[s] * ncls + c] & AC_ROW) / ncls;
+            fail[t] = f;
+            ac->dict[t] = ac->pattern[f] >= 0 ? f : ac->dict[f];
+            queue[tail++] = t;
+            ac->delta[s * ncls + c] = t * ncls |
+                (ac->pattern[t] >= 0 || ac->dict[t] >= 0 ? AC_OUT : 0);
+        }
+    }
+
+    free(go);
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+// Count visits to matching states for matches ending in [from, to). The
+// automaton is warmed up on the maxlen - 1 bytes before from so a match
+// crossing into the range is still seen.
+void ac_scan(const Automaton *ac, const char *data, size_t from, size_t to, long *hits) {
+    if (ac->maxlen == 0) return;
+
+    const uint32_t *delta = ac->delta;
+    const uint16_t *cls = ac->cls;
+    uint32_t s = 0;
+    for (size_t p = from > ac->maxlen - 1 ? from - (ac->maxlen - 1) : 0; p < from; p++)
+        s = delta[(s & AC_ROW) + cls[(unsigned char)data[p]]];
+
+    for (size_t p = from; p < to; p++) {
+        s = delta[(s & AC_ROW) + cls[(unsigned char)data[p]]];
+        if (s & AC_OUT)
+            hits[(s & AC_ROW) / ac->nclasses]++;
+    }
+}
+
+// Turn per-state visits into per-keyword counts (counts[] has n entries)
+void ac_tally(const Automaton *ac, const long *hits, long *counts) {
+    for (int s = 1; s < ac->nstates; s++) {
+        if (!hits[s]) continue;
+        for (int t = ac->pattern[s] >= 0 ? s : ac->dict[s]; t >= 0; t = ac->dict[t])
+            counts[ac->pattern[t]] += hits[s];
+    }
+}
+
 // ====== THREAD STRUCT ======
 typedef struct {
     char *data;
     size_t start;
     size_t end;
-    const char *keyword;
-    long count;
+    size_t size;            // whole mapping: a match may run past end
+    const Searcher *needles;
+    int nneedles;
+    count_fn fn;
+    const Automaton *ac;    // set when several keywords (or -i) are searched
+    long *hits;             // per-state visits for ac
+    long counts[MAX_NEEDLES];
 } ThreadArg;
 
 // ====== THREAD WORKER ======
+// One pass over the chunk does everything: each SEARCH_SLICE step runs the
+// fused needle kernel, then the automaton over the same bytes while they
+// are still in cache.
 void *search_worker(void *arg) {
     ThreadArg *t = (ThreadArg*)arg;
+    for (size_t p = t->start; p < t->end && !stopFlag; p += SEARCH_SLICE) {
+        size_t end = t->end - p < SEARCH_SLICE ? t->end : p + SEARCH_SLICE;
+        t->fn(t->needles, t->nneedles, t->data, p, end, t->size, t->counts);
+        if (t->ac)
+            ac_scan(t->ac, t->data, p, end, t->hits);
+    }
+    return NULL;
+}
 
-    for (size_t i = t->start; i < t->end; i++) {
-        if (stopFlag) break;
-        if (strncmp(&t->data[i], t->keyword, strlen(t->keyword)) == 0) {
-            t->count++;
+// Move a chunk boundary to the start of the next line
+size_t line_start(const char *data, size_t pos, size_t size) {
+    if (pos == 0 || pos >= size) return pos < size ? pos : size;
+    const char *nl = memchr(data + pos - 1, '\n', size - pos + 1);
+    return nl ? (size_t)(nl - data) + 1 : size;
+}
+
+// ====== PATTERN LIST ======
+// Takes ownership of pat
+int add_pattern(char ***pats, int *n, int *cap, char *pat) {
+    if (!pat) return -1;
+    if (*n == *cap) {
+        int grow = *cap ? *cap * 2 : 16;
+        char **p = realloc(*pats, grow * sizeof(char *));
+        if (!p) {
+            free(pat);
+            return -1;
         }
+        *pats = p;
+        *cap = grow;
     }
-    return NULL;
+    (*pats)[(*n)++] = pat;
+    return 0;
+}
+
+// One keyword per line; blank lines are skipped
+int load_patterns(const char *path, char ***pats, int *n, int *cap) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, fp)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0) continue;
+        if (add_pattern(pats, n, cap, strdup(line)) < 0) {
+            free(line);
+            fclose(fp);
+            fprintf(stderr, "Error: out of memory reading %s\n", path);
+            return -1;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
 }
 
 // ====== HELP MENU ======
@@ -45,7 +409,9 @@ void print_help() {
            "Options:\n"
            "  -h, --help               Show help menu\n"
            "  -f, --file <path>        Path to log file (required)\n"
-           "  -k, --keyword <word>     Count occurrences of keyword\n"
+           "  -k, --keyword <word>     Count occurrences of keyword (repeatable)\n"
+           "  -p, --patterns <file>    Count every keyword listed in file, one per line\n"
+           "  -i, --ignore-case        Match keywords regardless of case\n"
            "  -e, --error              Count error-level lines\n"
            "  -s, --stats              Show file statistics\n"
            "  -t, --threads <N>        Enable multithreaded search\n"
@@ -57,7 +423,9 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, handle_sigint);
 
     char *filepath = NULL;
-    char *keyword = NULL;
+    char **patterns = NULL;
+    int npatterns = 0, pattern_cap = 0;
+    int nocase = 0;
     int show_error = 0;
     int show_stats = 0;
     int show_memory = 0;
@@ -68,6 +436,8 @@ int main(int argc, char *argv[]) {
         {"help",    no_argument,       0, 'h'},
         {"file",    required_argument, 0, 'f'},
         {"keyword", required_argument, 0, 'k'},
+        {"patterns", required_argument, 0, 'p'},
+        {"ignore-case", no_argument,   0, 'i'},
         {"error",   no_argument,       0, 'e'},
         {"stats",   no_argument,       0, 's'},
         {"threads", required_argument, 0, 't'},
@@ -76,11 +446,21 @@ int main(int argc, char *argv[]) {
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "hf:k:est:ml:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hf:k:p:iest:ml:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h': print_help(); return 0;
             case 'f': filepath = optarg; break;
-            case 'k': keyword = optarg; break;
+            case 'k':
+                if (add_pattern(&patterns, &npatterns, &pattern_cap, strdup(optarg)) < 0) {
+                    fprintf(stderr, "Error: out of memory.\n");
+                    return 1;
+                }
+                break;
+            case 'p':
+                if (load_patterns(optarg, &patterns, &npatterns, &pattern_cap) < 0)
+                    return 1;
+                break;
+            case 'i': nocase = 1; break;
             case 'e': show_error = 1; break;
             case 's': show_stats = 1; break;
             case 'm': show_memory = 1; break;
@@ -94,6 +474,14 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // One keyword keeps the SIMD searcher; more (or -i) share one automaton
+    int use_ac = npatterns > 1 || (npatterns == 1 && nocase);
+    Automaton ac;
+    if (use_ac && ac_build(&ac, patterns, npatterns, nocase) < 0) {
+        fprintf(stderr, "Error: too many keywords to compile.\n");
+        return 1;
+    }
+
     // ====== OPEN FILE ======
     int fd = open(filepath, O_RDONLY);
     if (fd < 0) {
@@ -113,48 +501,84 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    const char *engine;
+    count_fn fn = select_search(&engine);
+
     if (show_memory) {
         printf("Mapped file size: %zu bytes\n", filesize);
-        printf("Start address: %p\n\n", map);
+        printf("Start address: %p\n", map);
+        printf("Search engine: %s\n", engine);
+        if (use_ac)
+            printf("Keyword automaton: %d states x %d classes (%zu bytes)\n",
+                   ac.nstates, ac.nclasses, (size_t)ac.nstates * ac.nclasses * sizeof(uint32_t));
+        printf("\n");
     }
 
-    long keyword_count = 0;
+    long *keyword_counts = calloc(npatterns ? npatterns : 1, sizeof(long));
     long error_count = 0;
     long line_count = 0;
 
-    // ====== LINE COUNT + ERROR DETECTION ======
-    for (size_t i = 0; i < filesize; i++) {
-        if (map[i] == '\n') line_count++;
+    // ====== NEEDLES FOR THE FUSED PASS ======
+    Searcher needles[MAX_NEEDLES];
+    int nneedles = 0;
+    int nl_slot = -1, level_slot = -1, keyword_slot = -1;
+    if (show_stats) {
+        nl_slot = nneedles;
+        searcher_init(&needles[nneedles++], "\n");
+    }
+    if (show_error) {
+        level_slot = nneedles;
+        searcher_init(&needles[nneedles++], "ERROR");
+        searcher_init(&needles[nneedles++], "WARN");
+        searcher_init(&needles[nneedles++], "CRIT");
+    }
+    if (npatterns && !use_ac) {
+        keyword_slot = nneedles;
+        searcher_init(&needles[nneedles++], patterns[0]);
+    }
 
-        if (stopFlag) break;
+    // ====== MULTITHREADED SCAN ======
+    // Every thread gets whole lines, and counts only the matches that start
+    // (automaton: end) in its chunk, so the totals do not depend on -t.
+    if (thread_count < 1)
+        thread_count = 1;
+    pthread_t threads[thread_count];
+    ThreadArg args[thread_count];
+    size_t chunk = filesize / thread_count;
 
-        if (show_error) {
-            if (strncmp(&map[i], "ERROR", 5) == 0 ||
-                strncmp(&map[i], "WARN", 4) == 0 ||
-                strncmp(&map[i], "CRIT", 4) == 0) {
-                error_count++;
-            }
+    for (int i = 0; i < thread_count; i++) {
+        args[i].hits = use_ac ? calloc(ac.nstates, sizeof(long)) : NULL;
+        if ((use_ac && !args[i].hits) || !keyword_counts) {
+            perror("calloc");
+            return 1;
         }
     }
 
-    // ====== MULTITHREADED KEYWORD SEARCH ======
-    if (keyword) {
-        pthread_t threads[thread_count];
-        ThreadArg args[thread_count];
-        size_t chunk = filesize / thread_count;
-
-        for (int i = 0; i < thread_count; i++) {
-            args[i].data = map;
-            args[i].start = i * chunk;
-            args[i].end = (i == thread_count - 1) ? filesize : (i+1)*chunk;
-            args[i].keyword = keyword;
-            args[i].count = 0;
-            pthread_create(&threads[i], NULL, search_worker, &args[i]);
-        }
+    for (int i = 0; i < thread_count; i++) {
+        memset(args[i].counts, 0, sizeof(args[i].counts));
+        args[i].data = map;
+        args[i].start = line_start(map, i * chunk, filesize);
+        args[i].end = (i == thread_count - 1) ? filesize : line_start(map, (i+1)*chunk, filesize);
+        args[i].size = filesize;
+        args[i].needles = needles;
+        args[i].nneedles = nneedles;
+        args[i].fn = fn;
+        args[i].ac = use_ac ? &ac : NULL;
+        pthread_create(&threads[i], NULL, search_worker, &args[i]);
+    }
 
-        for (int i = 0; i < thread_count; i++) {
-            pthread_join(threads[i], NULL);
-            keyword_count += args[i].count;
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+        if (nl_slot >= 0)
+            line_count += args[i].counts[nl_slot];
+        if (level_slot >= 0)
+            error_count += args[i].counts[level_slot] + args[i].counts[level_slot + 1]
+                         + args[i].counts[level_slot + 2];
+        if (keyword_slot >= 0)
+            keyword_counts[0] += args[i].counts[keyword_slot];
+        if (use_ac) {
+            ac_tally(&ac, args[i].hits, keyword_counts);
+            free(args[i].hits);
         }
     }
 
@@ -165,11 +589,21 @@ int main(int argc, char *argv[]) {
     if (show_error)
         printf("[ERROR] Error-like lines: %ld\n", error_count);
 
-    if (keyword)
-        printf("[KEYWORD] '%s' found %ld times\n", keyword, keyword_count);
+    for (int i = 0; i < npatterns; i++) {
+        long count = keyword_counts[0];
+        if (use_ac)
+            count = ac.alias[i] < 0 ? (long)filesize : keyword_counts[ac.alias[i]];
+        printf("[KEYWORD] '%s' found %ld times\n", patterns[i], count);
+    }
 
     munmap(map, filesize);
     close(fd);
+    free(keyword_counts);
+    if (use_ac)
+        ac_free(&ac);
+    for (int i = 0; i < npatterns; i++)
+        free(patterns[i]);
+    free(patterns);
 
     return 0;
 }
@@ -15,6 +15,61 @@ fi
 echo "✅ Compilation successful!"
 echo ""
 
+# ===========================
+#   EXACT COUNT TESTS
+# ===========================
+# Small generated logs whose counts are known; these need no huge.log
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+
+# check <name> <expected output> <loganalyzer args...>
+check() {
+    local name=$1 expected=$2
+    shift 2
+    local got
+    got=$(./loganalyzer "$@")
+    if [ "$got" == "$expected" ]; then
+        echo "✅ $name"
+    else
+        echo "❌ $name"
+        echo "   expected: $expected"
+        echo "   got:      $got"
+    fi
+}
+
+echo "===== EXACT COUNTS: search engine ====="
+# Keyword ends on the last byte of a page-sized file with no trailing newline
+{ printf 'INFO start\nWARN low disk\nCRIT fan\n'; head -c 4057 /dev/zero | tr '\0' 'x'; printf 'ERROR'; } > "$SCRATCH/end.log"
+check "Keyword at the very end, no trailing newline" \
+    "$(printf "[STATS] Total lines: 3\n[ERROR] Error-like lines: 3\n[KEYWORD] 'ERROR' found 1 times")" \
+    -f "$SCRATCH/end.log" -s -e -k ERROR
+check "Keyword at the very end, 4 threads" "[KEYWORD] 'ERROR' found 1 times" \
+    -f "$SCRATCH/end.log" -k ERROR -t 4
+
+printf 'aaaa' > "$SCRATCH/overlap.log"
+check "Overlapping matches: 'aa' in 'aaaa'" "[KEYWORD] 'aa' found 3 times" -f "$SCRATCH/overlap.log" -k aa
+check "Overlapping matches across thread chunks" "[KEYWORD] 'aa' found 3 times" -f "$SCRATCH/overlap.log" -k aa -t 3
+echo ""
+
+echo "===== EXACT COUNTS: several keywords ====="
+printf 'she sells sea shells\nhers he said\nhis shell\n' > "$SCRATCH/shells.log"
+check "Overlapping, prefix-sharing keywords in one pass" \
+    "$(printf "[KEYWORD] 'he' found 5 times\n[KEYWORD] 'she' found 3 times\n[KEYWORD] 'his' found 1 times\n[KEYWORD] 'hers' found 1 times\n[KEYWORD] 's' found 10 times\n[KEYWORD] 'sh' found 3 times\n[KEYWORD] 'shell' found 2 times")" \
+    -f "$SCRATCH/shells.log" -k he -k she -k his -k hers -k s -k sh -k shell -t 3
+
+printf 'he\nshe\n\nshell\nhe\n' > "$SCRATCH/patterns.txt"
+check "Patterns file (blank line skipped, repeated keyword)" \
+    "$(printf "[KEYWORD] 'he' found 5 times\n[KEYWORD] 'she' found 3 times\n[KEYWORD] 'shell' found 2 times\n[KEYWORD] 'he' found 5 times")" \
+    -f "$SCRATCH/shells.log" --patterns "$SCRATCH/patterns.txt"
+
+printf 'Error error ERROR eRRor\nWARN warning\n' > "$SCRATCH/case.log"
+check "Ignore case, one keyword" "[KEYWORD] 'error' found 4 times" -f "$SCRATCH/case.log" -k error -i
+check "Ignore case, several keywords" \
+    "$(printf "[KEYWORD] 'error' found 4 times\n[KEYWORD] 'warn' found 2 times\n[KEYWORD] 'ERR' found 4 times")" \
+    -f "$SCRATCH/case.log" -k error -k warn -k ERR -i
+echo ""
+
 # ======= Configuration ========
 LOGFILE="huge.log"
 KEYWORD="ERROR"
@@ -55,4 +110,8 @@ echo "===== TEST 5: Stats ====="
 ./loganalyzer -f "$LOGFILE" -s
 echo ""
 
+echo "===== TEST 6: Stats, errors and keyword in one pass ====="
+./loganalyzer -f "$LOGFILE" -s -e -k "$KEYWORD" -t $THREADS
+echo ""
+
 echo "🎉 ALL TESTS COMPLETED"
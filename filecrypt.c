@@ -13,70 +13,3050 @@
 #include <pthread.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sched.h>
 
-#define MAX_THREADS 32
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define MAX_THREADS 1024                    // sanity bound only; default is online CPUs
+#define CANCEL_BLOCK (64UL << 10)           // bytes transformed between stop checks
+#define POOL_GRAIN (256UL << 10)            // range size pulled by pool workers
+#define HUGE_PAGE (2UL << 20)               // transparent huge page size on x86-64
+
+#define CIPHER_CAESAR 0
+#define CIPHER_CHACHA20 1
+#define HEADER_MAGIC "FCR1"
+#define SALT_SIZE 16
+#define KDF_ITERATIONS 100000               // PBKDF2 rounds, paid once per run
+
+#define JOURNAL_MAGIC "FCJ2"
+#define JOURNAL_SUFFIX ".fcj"
+#define SUM_MAGIC "FCS2"
+#define SUM_SUFFIX ".fcsum"
+#define MAP_MAGIC "FCM1"
+#define MAP_SUFFIX ".fcmap"
+#define CRC32C_POLY 0x82f63b78U             // Castagnoli, bit-reflected
+#define CRC32C_LANE 4096                    // bytes per interleaved crc32 lane
+
+#define PIPE_SIZE (1 << 20)                 // requested pipe capacity in pipe mode
+
+#define BENCH_SIZE (256UL << 20)            // default generated bench file
+#define BENCH_TRIALS 5
+#define BENCH_MAX_POINTS 16                 // values per sweep list
+
+#define SMALL_FILE_MAX (1UL << 20)          // batch mode: files below this are grouped
+#define BATCH_BYTES (16UL << 20)            // batch mode: bytes per small-file batch
+#define BATCH_FILES 1024                    // batch mode: files per small-file batch
+#define STREAM_SLOTS 3                      // triple buffering: read / transform / write
+#define DEFAULT_CHUNK_SIZE (8UL << 20)      // 8 MiB per streaming chunk
+#define DIRECT_ALIGN 4096UL                 // O_DIRECT offset, length and address alignment
+#define DIRECT_DEPTH 8                      // default --direct requests in flight
 
 // ---------------------------- GLOBALS ----------------------------
 
-// Signal flag
-volatile sig_atomic_t stop_requested = 0;
+// Signal flag
+volatile sig_atomic_t stop_requested = 0;
+
+// Where "-o -" output goes; stdout itself is pointed at stderr for messages
+int data_out_fd = STDOUT_FILENO;
+
+// Cipher settings shared by every job of a run
+typedef struct {
+    int cipher;            // CIPHER_CAESAR or CIPHER_CHACHA20
+    int encrypt;           // 1 = encrypt, 0 = decrypt
+    int key;               // Caesar shift
+    uint32_t chacha[16];   // ChaCha20 state template (constants, key, nonce)
+} crypt_params_t;
+
+// Header written in front of chacha20 output (Caesar output has none)
+typedef struct {
+    char magic[4];
+    uint8_t cipher;
+    uint8_t reserved[3];
+    uint8_t salt[SALT_SIZE];
+    uint8_t nonce[8];
+} file_header_t;
+
+// CRC32C of a range before and after the transform
+typedef struct {
+    uint32_t in;
+    uint32_t out;
+} crc_pair_t;
+
+// One data extent of a sparse file, in payload offsets
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} extent_t;
+
+// Extent map sidecar <output>.fcmap: this header, then count extent_t
+typedef struct {
+    char magic[4];         // MAP_MAGIC
+    uint8_t reserved[4];
+    uint64_t data_size;    // payload bytes, holes included
+    uint64_t count;
+} extent_map_header_t;
+
+// Checksum sidecar written next to encrypted output as <output>.fcsum
+typedef struct {
+    char magic[4];         // SUM_MAGIC
+    uint8_t cipher;
+    uint8_t reserved[3];
+    uint32_t plain_crc;    // plaintext CRC32C; keyed tag of it for chacha20
+    uint32_t cipher_crc;   // CRC32C of the ciphertext payload (after any header)
+    uint64_t data_size;    // payload bytes
+} checksum_file_t;
+
+// Thread job structure
+typedef struct {
+    unsigned char *data;       // destination
+    const unsigned char *src;  // source (== data when in place)
+    size_t start;
+    size_t end;
+    uint64_t offset;           // stream position of data[0], selects keystream
+    const crypt_params_t *params;
+    int whole;                 // 1 = finish the range even if a signal arrives
+} thread_job_t;
+
+typedef struct worker_pool worker_pool_t;
+
+// One pool thread and its running byte count
+typedef struct {
+    pthread_t thread;
+    worker_pool_t *pool;
+    size_t bytes;
+    int pinned_cpu;        // -1 = free to migrate
+    unsigned cpu, node;    // where it last ran a job
+} pool_worker_t;
+
+// Persistent worker pool fed through a shared atomic cursor
+struct worker_pool {
+    pool_worker_t *workers;
+    int count;
+    size_t grain;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    const thread_job_t *segs;   // current job: segments laid end to end
+    const size_t *bases;        // virtual start of each segment
+    int nsegs;
+    size_t total;               // sum of segment sizes
+    atomic_size_t cursor;       // next unclaimed virtual offset
+    atomic_uint_fast64_t *done; // journal bitmap, one bit per grain (single segment only)
+    crc_pair_t *crcs;           // per-piece CRCs of the current job, NULL = off
+    unsigned long generation;   // bumped for every new job
+    int active;                 // workers still on the current job
+    int shutdown;
+};
+
+void pool_destroy(worker_pool_t *pool);
+
+// Streaming pipeline slot states
+enum { SLOT_FREE, SLOT_FILLED, SLOT_TRANSFORMED };
+
+// One chunk buffer in the streaming ring
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    int state;
+    int last;    // 1 = final chunk (EOF, error or stop)
+} stream_slot_t;
+
+// Shared state of the read -> transform -> write pipeline
+typedef struct {
+    stream_slot_t slots[STREAM_SLOTS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int in_fd;
+    int out_fd;
+    size_t chunk_size;
+    int error;   // errno of the first failing read/write
+    int closed;  // transform stage has finished
+    size_t bytes_written;
+} stream_ctx_t;
+
+// On-disk journal: this header, then one bit per POOL_GRAIN chunk
+typedef struct {
+    char magic[4];         // JOURNAL_MAGIC
+    uint32_t chunk_size;
+    uint64_t data_size;    // payload bytes (after any chacha20 header)
+    uint8_t cipher;
+    uint8_t encrypt;
+    uint8_t reserved[6];
+    uint8_t key_check[8];  // HMAC of a constant under the key (journal_key_check)
+} journal_header_t;
+
+// In-memory chunk journal for one file
+typedef struct {
+    uint64_t data_size;
+    size_t nchunks;
+    atomic_uint_fast64_t *bits;
+    uint8_t key_check[8];  // as loaded, compared once the cipher is set up
+} journal_t;
+
+// Settings shared by every file of a run
+typedef struct {
+    int stream;            // -s: chunked read -> transform -> write pipeline
+    int map_out;           // -m: MAP_SHARED output / in place
+    size_t chunk_size;
+    int resume;            // --resume: only process chunks missing from the journal
+    int direct;            // --direct: O_DIRECT reads/writes through an I/O ring
+    int depth;             // --queue-depth: direct I/O requests in flight
+    int sparse;            // --sparse: only transform data extents, keep holes
+} run_opts_t;
+
+// Outcome of one crypt_file() call
+typedef struct {
+    size_t size;           // input size
+    size_t written;        // payload bytes written
+    int in_place;
+    int streamed;          // went through the chunk pipeline
+    double elapsed;
+    int has_crc;           // crc is valid (not resumed or interrupted)
+    crc_pair_t crc;        // CRC32C of input and output payload
+    int verified;          // 1 = matched <input>.fcsum, 0 = no sidecar
+    size_t buffered;       // size of the whole-file buffer, 0 if none
+    size_t huge;           // bytes of it backed by transparent huge pages
+    const char *io;        // direct mode: how the I/O was done, NULL otherwise
+    size_t extents;        // sparse mode: data extents transformed, 0 otherwise
+    uint64_t data_bytes;   // sparse mode: bytes in those extents
+} file_result_t;
+
+// One input/output pair in batch mode
+typedef struct {
+    char *in;
+    char *out;
+    size_t size;
+} batch_file_t;
+
+typedef struct {
+    batch_file_t *files;
+    size_t count;
+    size_t cap;
+} file_list_t;
+
+// Small files transformed together by one pool job
+typedef struct {
+    unsigned char *buf;
+    size_t used;
+    int count;
+    thread_job_t segs[BATCH_FILES];
+    crypt_params_t params[BATCH_FILES];
+    file_header_t hdrs[BATCH_FILES];
+    const batch_file_t *files[BATCH_FILES];
+} small_batch_t;
+
+// ---------------------------- SIGNAL HANDLING ----------------------------
+void signal_handler(int sig) {
+    stop_requested = 1;
+    fprintf(stderr, "\n[!] Signal received (%d). Stopping safely...\n", sig);
+}
+
+// ---------------------------- SECURE KEY ENTRY ----------------------------
+// Read up to one line from fd without reading past the newline, so the
+// rest of a --key-fd pipe is left untouched
+void read_line(int fd, char *buf, size_t len) {
+    size_t n = 0;
+    char c;
+    while (n + 1 < len && read(fd, &c, 1) == 1 && c != '\n')
+        buf[n++] = c;
+    buf[n] = '\0';
+}
+
+// Prompt on the terminal fd and read one line with echo disabled
+void secure_read(int fd, const char *prompt, char *buf, size_t len) {
+    struct termios oldt, newt;
+
+    printf("%s", prompt);
+    fflush(stdout);
+
+    int tty = tcgetattr(fd, &oldt) == 0;   // backup
+    if (tty) {
+        newt = oldt;
+        newt.c_lflag &= ~ECHO;            // disable echo
+        tcsetattr(fd, TCSANOW, &newt);
+    }
+
+    read_line(fd, buf, len);
+
+    if (tty) tcsetattr(fd, TCSANOW, &oldt); // restore
+    printf("\n");
+}
+
+// Get the key or passphrase from --key-file, --key-fd or the terminal.
+// When stdin carries the data the prompt goes to /dev/tty instead.
+int get_secret(const char *prompt, char *buf, size_t len,
+               int key_fd, const char *key_file, int stdin_busy) {
+    if (key_file) {
+        int fd = open(key_file, O_RDONLY);
+        if (fd < 0) { perror("open key file"); return -1; }
+        read_line(fd, buf, len);
+        close(fd);
+    } else if (key_fd >= 0) {
+        read_line(key_fd, buf, len);
+    } else if (stdin_busy) {
+        int fd = open("/dev/tty", O_RDWR);
+        if (fd < 0) {
+            fprintf(stderr, "No terminal for the key prompt; use --key-fd or --key-file.\n");
+            return -1;
+        }
+        secure_read(fd, prompt, buf, len);
+        close(fd);
+    } else {
+        secure_read(STDIN_FILENO, prompt, buf, len);
+    }
+    return 0;
+}
+
+// ---------------------------- CAESAR KERNELS ----------------------------
+// dst[i] = src[i] + shift (mod 256). dst may equal src.
+typedef void (*caesar_fn)(unsigned char *dst, const unsigned char *src,
+                          size_t n, unsigned char shift);
+
+// Scalar reference; every vector kernel must match it byte for byte
+void caesar_scalar(unsigned char *dst, const unsigned char *src,
+                   size_t n, unsigned char shift) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (unsigned char)(src[i] + shift);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void caesar_sse2(unsigned char *dst, const unsigned char *src,
+                 size_t n, unsigned char shift) {
+    __m128i k = _mm_set1_epi8((char)shift);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(v, k));
+    }
+    caesar_scalar(dst + i, src + i, n - i, shift);
+}
+
+__attribute__((target("avx2")))
+void caesar_avx2(unsigned char *dst, const unsigned char *src,
+                 size_t n, unsigned char shift) {
+    __m256i k = _mm256_set1_epi8((char)shift);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi8(a, k));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_add_epi8(b, k));
+    }
+    caesar_sse2(dst + i, src + i, n - i, shift);
+}
+
+__attribute__((target("avx512bw")))
+void caesar_avx512(unsigned char *dst, const unsigned char *src,
+                   size_t n, unsigned char shift) {
+    __m512i k = _mm512_set1_epi8((char)shift);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_add_epi8(v, k));
+    }
+    if (i < n) {
+        // Masked tail: no scalar loop needed
+        __mmask64 m = (__mmask64)-1 >> (64 - (n - i));
+        __m512i v = _mm512_maskz_loadu_epi8(m, src + i);
+        _mm512_mask_storeu_epi8(dst + i, m, _mm512_add_epi8(v, k));
+    }
+}
+#endif
+
+typedef struct {
+    const char *name;
+    caesar_fn fn;
+    const char *cpu_feature; // NULL = always available
+} caesar_kernel_t;
+
+// Ordered slowest to fastest
+const caesar_kernel_t caesar_kernels[] = {
+    {"scalar", caesar_scalar, NULL},
+#ifdef HAVE_X86_SIMD
+    {"sse2", caesar_sse2, "sse2"},
+    {"avx2", caesar_avx2, "avx2"},
+    {"avx512", caesar_avx512, "avx512bw"},
+#endif
+};
+#define N_KERNELS (int)(sizeof(caesar_kernels) / sizeof(caesar_kernels[0]))
+
+int kernel_supported(const caesar_kernel_t *k) {
+    if (!k->cpu_feature) return 1;
+#ifdef HAVE_X86_SIMD
+    // __builtin_cpu_supports needs a literal feature name
+    if (strcmp(k->cpu_feature, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(k->cpu_feature, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(k->cpu_feature, "avx512bw") == 0) return __builtin_cpu_supports("avx512bw");
+#endif
+    return 0;
+}
+
+// Selected at startup by select_kernel()
+const caesar_kernel_t *active_kernel = &caesar_kernels[0];
+
+// Pick the fastest kernel the CPU supports (cpuid via __builtin_cpu_supports)
+void select_kernel(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+#endif
+    for (int i = 0; i < N_KERNELS; i++) {
+        if (kernel_supported(&caesar_kernels[i]))
+            active_kernel = &caesar_kernels[i];
+    }
+}
+
+// Compare every supported kernel against the scalar reference over
+// all shifts, odd lengths and misaligned offsets. Returns failures.
+int kernel_selftest(void) {
+    enum { MAXLEN = 1024 + 67 };
+    unsigned char src[MAXLEN + 64], ref[MAXLEN + 64], out[MAXLEN + 64];
+    int failures = 0;
+
+    srand(332);
+    for (size_t i = 0; i < sizeof(src); i++) src[i] = rand() & 0xff;
+
+    for (int k = 0; k < N_KERNELS; k++) {
+        const caesar_kernel_t *kern = &caesar_kernels[k];
+        if (!kernel_supported(kern)) {
+            printf("[-] %-7s skipped (not supported by CPU)\n", kern->name);
+            continue;
+        }
+        int bad = 0;
+        for (int shift = 0; shift < 256 && !bad; shift++) {
+            for (size_t len = 0; len <= MAXLEN && !bad; len += (len < 130 ? 1 : 61)) {
+                size_t off = (len + shift) % 64;
+                caesar_scalar(ref, src + off, len, shift);
+                kern->fn(out, src + off, len, shift);
+                if (memcmp(ref, out, len) != 0) bad = 1;
+
+                // In-place must agree as well
+                memcpy(out, src + off, len);
+                kern->fn(out, out, len, shift);
+                if (memcmp(ref, out, len) != 0) bad = 1;
+            }
+        }
+        printf("[%c] %-7s %s\n", bad ? '!' : '+', kern->name, bad ? "MISMATCH" : "ok");
+        failures += bad;
+    }
+    return failures;
+}
+
+// ---------------------------- SHA-256 / PBKDF2 (Key Derivation) ----------------------------
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    unsigned char buf[64];
+    size_t fill;
+} sha256_ctx_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void sha256_compress(uint32_t h[8], const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 | (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void sha256_init(sha256_ctx_t *c) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(c->h, iv, sizeof(iv));
+    c->len = 0;
+    c->fill = 0;
+}
+
+void sha256_update(sha256_ctx_t *c, const void *data, size_t n) {
+    const unsigned char *p = data;
+    c->len += n;
+    while (n > 0) {
+        size_t take = 64 - c->fill < n ? 64 - c->fill : n;
+        memcpy(c->buf + c->fill, p, take);
+        c->fill += take;
+        p += take;
+        n -= take;
+        if (c->fill == 64) {
+            sha256_compress(c->h, c->buf);
+            c->fill = 0;
+        }
+    }
+}
+
+void sha256_final(sha256_ctx_t *c, unsigned char out[32]) {
+    uint64_t bits = c->len * 8;
+    unsigned char pad = 0x80;
+    sha256_update(c, &pad, 1);
+    pad = 0;
+    while (c->fill != 56) sha256_update(c, &pad, 1);
+    unsigned char lenbuf[8];
+    for (int i = 0; i < 8; i++) lenbuf[i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_update(c, lenbuf, 8);
+    for (int i = 0; i < 8; i++) {
+        out[4*i] = c->h[i] >> 24; out[4*i+1] = c->h[i] >> 16;
+        out[4*i+2] = c->h[i] >> 8; out[4*i+3] = c->h[i];
+    }
+}
+
+void hmac_sha256(const unsigned char *key, size_t key_len,
+                 const unsigned char *msg, size_t msg_len, unsigned char out[32]) {
+    unsigned char k[64] = {0}, pad[64], inner[32];
+    sha256_ctx_t c;
+
+    if (key_len > 64) {
+        sha256_init(&c);
+        sha256_update(&c, key, key_len);
+        sha256_final(&c, k);
+    } else {
+        memcpy(k, key, key_len);
+    }
+
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+    sha256_init(&c);
+    sha256_update(&c, pad, 64);
+    sha256_update(&c, msg, msg_len);
+    sha256_final(&c, inner);
+
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+    sha256_init(&c);
+    sha256_update(&c, pad, 64);
+    sha256_update(&c, inner, 32);
+    sha256_final(&c, out);
+}
+
+// PBKDF2-HMAC-SHA256 producing a single 32-byte block
+void pbkdf2_sha256(const char *pass, const unsigned char *salt, size_t salt_len,
+                   unsigned iterations, unsigned char out[32]) {
+    unsigned char msg[64 + 4], u[32];
+    size_t plen = strlen(pass);
+
+    memcpy(msg, salt, salt_len);
+    msg[salt_len] = 0; msg[salt_len + 1] = 0; msg[salt_len + 2] = 0; msg[salt_len + 3] = 1;
+    hmac_sha256((const unsigned char *)pass, plen, msg, salt_len + 4, u);
+    memcpy(out, u, 32);
+
+    for (unsigned i = 1; i < iterations; i++) {
+        hmac_sha256((const unsigned char *)pass, plen, u, 32, u);
+        for (int j = 0; j < 32; j++) out[j] ^= u[j];
+    }
+}
+
+// ---------------------------- CHACHA20 (Counter Mode) ----------------------------
+// State layout: words 0-3 constants, 4-11 key, 12-13 64-bit block counter,
+// 14-15 64-bit nonce. Keystream byte at offset pos comes from block pos/64,
+// so any range of the file can be processed independently by any worker.
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8);  \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+#define CHACHA_DOUBLE_ROUND(x) \
+    CHACHA_QR(x[0], x[4], x[8],  x[12]); CHACHA_QR(x[1], x[5], x[9],  x[13]); \
+    CHACHA_QR(x[2], x[6], x[10], x[14]); CHACHA_QR(x[3], x[7], x[11], x[15]); \
+    CHACHA_QR(x[0], x[5], x[10], x[15]); CHACHA_QR(x[1], x[6], x[11], x[12]); \
+    CHACHA_QR(x[2], x[7], x[8],  x[13]); CHACHA_QR(x[3], x[4], x[9],  x[14])
+
+static inline void store32_le(unsigned char *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline uint32_t load32_le(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Scalar reference: one 64-byte keystream block
+void chacha20_block(const uint32_t in[16], uint64_t counter, unsigned char out[64]) {
+    uint32_t x[16], s[16];
+    memcpy(s, in, sizeof(s));
+    s[12] = (uint32_t)counter;
+    s[13] = (uint32_t)(counter >> 32);
+    memcpy(x, s, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        CHACHA_DOUBLE_ROUND(x);
+    }
+    for (int i = 0; i < 16; i++) store32_le(out + 4 * i, x[i] + s[i]);
+}
+
+#ifdef HAVE_X86_SIMD
+#define CHACHA_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CHACHA_CLONES
+#endif
+
+#define CHACHA_LANES 16
+typedef uint32_t chacha_vec __attribute__((vector_size(4 * CHACHA_LANES)));
+
+// Vectorized: 16 blocks at once, one block per vector lane, then XOR n
+// (<= 1024) bytes of src into dst. Compiled for AVX-512, AVX2 and the
+// baseline ISA; the loader picks the clone matching the CPU (cpuid).
+CHACHA_CLONES
+void chacha20_xor16(const uint32_t in[16], uint64_t counter,
+                    unsigned char *dst, const unsigned char *src, size_t n) {
+    chacha_vec x[16], s[16];
+    uint32_t words[16][CHACHA_LANES];
+    unsigned char ks[64 * CHACHA_LANES] __attribute__((aligned(64)));
+
+    for (int j = 0; j < 16; j++) {
+        chacha_vec v = {0};
+        s[j] = v + in[j];
+    }
+    for (int b = 0; b < CHACHA_LANES; b++) {
+        s[12][b] = (uint32_t)(counter + b);
+        s[13][b] = (uint32_t)((counter + b) >> 32);
+    }
+    memcpy(x, s, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        CHACHA_DOUBLE_ROUND(x);
+    }
+    for (int j = 0; j < 16; j++) {
+        x[j] += s[j];
+        memcpy(words[j], &x[j], sizeof(words[j]));
+    }
+    // Transpose lanes back into block order
+    for (int b = 0; b < CHACHA_LANES; b++)
+        for (int j = 0; j < 16; j++)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            memcpy(ks + 64 * b + 4 * j, &words[j][b], 4);
+#else
+            store32_le(ks + 64 * b + 4 * j, words[j][b]);
+#endif
+
+    // XOR a whole vector at a time; memcpy keeps unaligned access legal
+    size_t i = 0;
+    for (; i + sizeof(chacha_vec) <= n; i += sizeof(chacha_vec)) {
+        chacha_vec a, k;
+        memcpy(&a, src + i, sizeof(a));
+        memcpy(&k, ks + i, sizeof(k));
+        a ^= k;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < n; i++) dst[i] = src[i] ^ ks[i];
+}
+
+// XOR the keystream starting at stream offset pos into src[0, n)
+void chacha20_xor(const uint32_t state[16], uint64_t pos,
+                  unsigned char *dst, const unsigned char *src, size_t n) {
+    while (n > 0) {
+        size_t skip = pos % 64;
+        size_t take;
+        if (skip == 0) {
+            take = n < 64 * CHACHA_LANES ? n : 64 * CHACHA_LANES;
+            chacha20_xor16(state, pos / 64, dst, src, take);
+        } else {
+            // Unaligned lead-in: finish the partial block with the scalar path
+            unsigned char ks[64];
+            chacha20_block(state, pos / 64, ks);
+            take = 64 - skip < n ? 64 - skip : n;
+            for (size_t i = 0; i < take; i++) dst[i] = src[i] ^ ks[skip + i];
+        }
+        dst += take;
+        src += take;
+        pos += take;
+        n -= take;
+    }
+}
+
+// Fill a ChaCha20 state template from a 256-bit key and 64-bit nonce
+void chacha20_setup(uint32_t state[16], const unsigned char key[32], const unsigned char nonce[8]) {
+    state[0] = 0x61707865; state[1] = 0x3320646e;   // "expand 32-byte k"
+    state[2] = 0x79622d32; state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) state[4 + i] = load32_le(key + 4 * i);
+    state[12] = 0;
+    state[13] = 0;
+    state[14] = load32_le(nonce);
+    state[15] = load32_le(nonce + 4);
+}
+
+// ---------------------------- CRC32C (Integrity) ----------------------------
+// CRC32C (Castagnoli) of the plaintext and ciphertext is folded into the
+// transform: each CANCEL_BLOCK is checksummed right before and after it
+// is transformed, while it is still in cache, so there is no second pass.
+// Values use the usual ~0 pre/post conditioning, so crc32c(0, ...) starts
+// a new checksum and the result of one call can be passed to the next.
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *p, size_t n);
+
+uint32_t crc32c_table[256];
+
+void crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[i] = c;
+    }
+}
+
+// Product of two polynomials mod the CRC polynomial (bit-reflected)
+uint32_t crc32c_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1U << 31, prod = 0;
+    for (;;) {
+        if (a & m) {
+            prod ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return prod;
+}
+
+// x^(8n) mod P: multiplying a CRC by this appends n zero bytes
+uint32_t crc32c_shift(uint64_t n) {
+    uint32_t xp = 1U << 31;          // x^0
+    uint32_t sq = 1U << 23;          // x^8: one byte
+    for (; n; n >>= 1) {
+        if (n & 1) xp = crc32c_multmodp(sq, xp);
+        sq = crc32c_multmodp(sq, sq);
+    }
+    return xp;
+}
+
+// CRC of A followed by B, given crc(A), crc(B) and len(B). Costs
+// O(log len) multiplications, so chunk CRCs can be merged without
+// touching the data again.
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    return crc32c_multmodp(crc32c_shift(len2), crc1) ^ crc2;
+}
+
+// Table-driven fallback for CPUs without SSE4.2
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(HAVE_X86_SIMD) && defined(__x86_64__)
+// x^(8 * CRC32C_LANE) and x^(16 * CRC32C_LANE), set by select_crc32c()
+uint32_t crc32c_lane_shift[2];
+
+// The crc32 instruction has a 3-cycle latency but issues every cycle, so
+// three lanes of CRC32C_LANE bytes run side by side and are merged with
+// two constant multiplications.
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+    uint64_t c = ~crc;
+    size_t i = 0;
+    for (; i + 3 * CRC32C_LANE <= n; i += 3 * CRC32C_LANE) {
+        const unsigned char *a = p + i, *b = a + CRC32C_LANE, *d = b + CRC32C_LANE;
+        uint64_t cb = 0, cd = 0, va, vb, vd;
+        for (size_t k = 0; k < CRC32C_LANE; k += 8) {
+            memcpy(&va, a + k, 8);
+            memcpy(&vb, b + k, 8);
+            memcpy(&vd, d + k, 8);
+            c = _mm_crc32_u64(c, va);
+            cb = _mm_crc32_u64(cb, vb);
+            cd = _mm_crc32_u64(cd, vd);
+        }
+        c = crc32c_multmodp(crc32c_lane_shift[1], (uint32_t)c) ^
+            crc32c_multmodp(crc32c_lane_shift[0], (uint32_t)cb) ^ (uint32_t)cd;
+    }
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; i < n; i++) c = _mm_crc32_u8((uint32_t)c, p[i]);
+    return ~(uint32_t)c;
+}
+#endif
+
+// Selected at startup by select_crc32c()
+crc32c_fn crc32c = crc32c_sw;
+const char *crc32c_name = "table";
+
+void select_crc32c(void) {
+    crc32c_init_table();
+#if defined(HAVE_X86_SIMD) && defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_lane_shift[0] = crc32c_shift(CRC32C_LANE);
+        crc32c_lane_shift[1] = crc32c_shift(2 * CRC32C_LANE);
+        crc32c = crc32c_hw;
+        crc32c_name = "sse4.2";
+    }
+#endif
+}
+
+// Known answer, hardware vs table, and combine checks. Returns failures.
+int crc32c_selftest(void) {
+    int failures = 0;
+
+    // The standard check value for CRC32C
+    int bad = crc32c_sw(0, (const unsigned char *)"123456789", 9) != 0xE3069283U ||
+              crc32c(0, (const unsigned char *)"123456789", 9) != 0xE3069283U;
+
+    enum { LEN = 3 * CRC32C_LANE * 2 + 99 };
+    static unsigned char buf[LEN];
+    for (int i = 0; i < LEN; i++) buf[i] = (unsigned char)(i * 131 + 7);
+    for (size_t off = 0; off < 8 && !bad; off++) {
+        for (size_t n = 0; n + off <= LEN && !bad; n += 997) {
+            uint32_t whole = crc32c_sw(0, buf + off, n);
+            if (crc32c(0, buf + off, n) != whole) bad = 1;
+            size_t cut = n / 3;
+            uint32_t a = crc32c(0, buf + off, cut), b = crc32c(0, buf + off + cut, n - cut);
+            if (crc32c_combine(a, b, n - cut) != whole) bad = 1;
+        }
+    }
+    printf("[%c] crc32c/%s %s\n", bad ? '!' : '+', crc32c_name, bad ? "MISMATCH" : "ok");
+    failures += bad;
+    return failures;
+}
+
+// ---------------------------- CIPHER SETUP ----------------------------
+char passphrase[256];                // entered once at startup
+unsigned char run_salt[SALT_SIZE];   // salt used for every file of this run
+unsigned char master_key[32];
+int have_master_key = 0;
+
+// Derive the master key only when the salt changes (normally once per run)
+void derive_master_key(const unsigned char salt[SALT_SIZE]) {
+    if (have_master_key && memcmp(salt, run_salt, SALT_SIZE) == 0) return;
+    pbkdf2_sha256(passphrase, salt, SALT_SIZE, KDF_ITERATIONS, master_key);
+    memcpy(run_salt, salt, SALT_SIZE);
+    have_master_key = 1;
+}
+
+// Encrypt: fresh nonce per file, run-wide salt. Fills hdr for the output.
+int cipher_setup_encrypt(crypt_params_t *p, file_header_t *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, HEADER_MAGIC, 4);
+    hdr->cipher = CIPHER_CHACHA20;
+
+    if (!have_master_key) {
+        unsigned char salt[SALT_SIZE];
+        if (getrandom(salt, sizeof(salt), 0) != sizeof(salt)) { perror("getrandom"); return -1; }
+        derive_master_key(salt);
+    }
+    if (getrandom(hdr->nonce, sizeof(hdr->nonce), 0) != sizeof(hdr->nonce)) {
+        perror("getrandom");
+        return -1;
+    }
+    memcpy(hdr->salt, run_salt, SALT_SIZE);
+    chacha20_setup(p->chacha, master_key, hdr->nonce);
+    return 0;
+}
+
+// Decrypt: validate the input header and load its salt and nonce
+int cipher_setup_decrypt(crypt_params_t *p, const file_header_t *hdr) {
+    if (memcmp(hdr->magic, HEADER_MAGIC, 4) != 0 || hdr->cipher != CIPHER_CHACHA20) {
+        fprintf(stderr, "Input is not a chacha20 filecrypt file.\n");
+        return -1;
+    }
+    derive_master_key(hdr->salt);
+    chacha20_setup(p->chacha, master_key, hdr->nonce);
+    return 0;
+}
+
+// Known-answer and cross-path checks for the ChaCha20 engine and KDF
+int chacha_selftest(void) {
+    int failures = 0;
+
+    // RFC 8439 2.3.2 block; its 32-bit counter + 96-bit nonce map onto
+    // our 64-bit counter words 12-13 and nonce words 14-15.
+    static const unsigned char expect[64] = {
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+    };
+    unsigned char key[32], nonce[8] = {0x00, 0x00, 0x00, 0x4a, 0, 0, 0, 0};
+    for (int i = 0; i < 32; i++) key[i] = i;
+    uint32_t st[16];
+    chacha20_setup(st, key, nonce);
+
+    unsigned char block[64];
+    chacha20_block(st, 0x0900000000000001ULL, block);
+    int bad = memcmp(block, expect, 64) != 0;
+    printf("[%c] chacha20 scalar block (RFC 8439) %s\n", bad ? '!' : '+', bad ? "MISMATCH" : "ok");
+    failures += bad;
+
+    // Vector path at odd offsets and lengths vs the scalar reference
+    enum { LEN = 5000 };
+    static unsigned char src[LEN], ref[LEN], out[LEN];
+    for (int i = 0; i < LEN; i++) src[i] = (unsigned char)(i * 7 + 3);
+    bad = 0;
+    for (uint64_t pos = 0; pos < 200 && !bad; pos += 37) {
+        for (size_t n = 0; n < LEN - 200; n += 613) {
+            for (size_t i = 0; i < n; i++) {
+                if (i == 0 || (pos + i) % 64 == 0) chacha20_block(st, (pos + i) / 64, block);
+                ref[i] = src[i] ^ block[(pos + i) % 64];
+            }
+            chacha20_xor(st, pos, out, src, n);
+            if (memcmp(ref, out, n) != 0) { bad = 1; break; }
+        }
+    }
+    printf("[%c] chacha20 vector path %s\n", bad ? '!' : '+', bad ? "MISMATCH" : "ok");
+    failures += bad;
+
+    // RFC 7914 / common PBKDF2-HMAC-SHA256 vector: "password", "salt", 1
+    static const unsigned char pbkdf2_expect[32] = {
+        0x12, 0x0f, 0xb6, 0xcf, 0xfc, 0xf8, 0xb3, 0x2c, 0x43, 0xe7, 0x22, 0x52, 0x56, 0xc4, 0xf8, 0x37,
+        0xa8, 0x65, 0x48, 0xc9, 0x2c, 0xcc, 0x35, 0x48, 0x08, 0x05, 0x98, 0x7c, 0xb7, 0x0b, 0xe1, 0x7b
+    };
+    unsigned char dk[32];
+    pbkdf2_sha256("password", (const unsigned char *)"salt", 4, 1, dk);
+    bad = memcmp(dk, pbkdf2_expect, 32) != 0;
+    printf("[%c] pbkdf2-sha256 %s\n", bad ? '!' : '+', bad ? "MISMATCH" : "ok");
+    failures += bad;
+
+    return failures;
+}
+
+// Cipher and vector ISA used for a run, for the timing output
+const char *engine_name(const crypt_params_t *p) {
+    static char name[48];
+    const char *isa = "generic";
+    if (p->cipher == CIPHER_CAESAR) {
+        snprintf(name, sizeof(name), "caesar/%s", active_kernel->name);
+        return name;
+    }
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")) isa = "avx512";
+    else if (__builtin_cpu_supports("avx2")) isa = "avx2";
+    else isa = "sse2";
+#endif
+    snprintf(name, sizeof(name), "chacha20/%s x%d blocks", isa, CHACHA_LANES);
+    return name;
+}
+
+// ---------------------------- TRANSFORM (Range Job) ----------------------------
+// Transform job->src[start, end) into job->data. If crc is set, the CRC32C
+// of the input and output bytes is appended to it in the same pass.
+// Returns 0 if cut short by a signal.
+int thread_transform(const thread_job_t *job, crc_pair_t *crc) {
+    const crypt_params_t *p = job->params;
+    unsigned char shift = (unsigned char)(p->encrypt ? p->key : -p->key);
+
+    // Cancellation is checked once per block, not per byte
+    for (size_t i = job->start; i < job->end; i += CANCEL_BLOCK) {
+        if (stop_requested && !job->whole) return 0;
+        size_t n = job->end - i < CANCEL_BLOCK ? job->end - i : CANCEL_BLOCK;
+        if (crc) crc->in = crc32c(crc->in, job->src + i, n);
+        if (p->cipher == CIPHER_CHACHA20)
+            chacha20_xor(p->chacha, job->offset + i, job->data + i, job->src + i, n);
+        else
+            active_kernel->fn(job->data + i, job->src + i, n, shift);
+        if (crc) crc->out = crc32c(crc->out, job->data + i, n);
+    }
+    return 1;
+}
+
+// ---------------------------- WORKER POOL ----------------------------
+// Threads are created once per run. For every job the workers pull
+// POOL_GRAIN-sized ranges from a shared atomic cursor, so a worker slowed
+// by page faults or a noisy neighbour simply takes fewer ranges.
+void *pool_worker(void *arg) {
+    pool_worker_t *w = (pool_worker_t *)arg;
+    worker_pool_t *pool = w->pool;
+    unsigned long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        for (;;) {
+            size_t off = atomic_fetch_add(&pool->cursor, pool->grain);
+            if (off >= pool->total || stop_requested) break;
+            size_t stop = pool->total - off < pool->grain ? pool->total : off + pool->grain;
+
+            // Binary search for the segment holding off, then walk forward;
+            // a grain may cover the tail of one small file and the next
+            int lo = 0, hi = pool->nsegs - 1;
+            while (lo < hi) {
+                int mid = (lo + hi + 1) / 2;
+                if (pool->bases[mid] <= off) lo = mid; else hi = mid - 1;
+            }
+            // Journaled run: grains finished by an earlier run are skipped,
+            // and a grain is never abandoned halfway so its bit stays exact
+            size_t grain_no = off / pool->grain;
+            uint64_t mask = 1ULL << (grain_no % 64);
+            if (pool->done && (atomic_load(&pool->done[grain_no / 64]) & mask)) continue;
+
+            int ok = 1;
+            for (int i = lo; i < pool->nsegs && pool->bases[i] < stop && ok; i++) {
+                thread_job_t job = pool->segs[i];
+                job.whole = pool->done != NULL;
+                size_t seg_end = pool->bases[i] + job.end;
+                job.start = off > pool->bases[i] ? off - pool->bases[i] : 0;
+                job.end = (stop < seg_end ? stop : seg_end) - pool->bases[i];
+                // Piece (grain, segment) gets slot grain_no + i: both only
+                // grow along the job, so slots never collide
+                ok = thread_transform(&job, pool->crcs ? &pool->crcs[grain_no + i] : NULL);
+                if (ok) w->bytes += job.end - job.start;
+            }
+            if (!ok) break;
+            if (pool->done) atomic_fetch_or(&pool->done[grain_no / 64], mask);
+        }
+        getcpu(&w->cpu, &w->node);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// With pin set, worker i is bound to the i-th CPU of our affinity mask
+// (wrapping around), set before the thread starts so even its stack is
+// first-touched on the right node.
+int pool_create(worker_pool_t *pool, int count, int pin) {
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+    pool->grain = POOL_GRAIN;
+    pool->workers = calloc(count, sizeof(pool_worker_t));
+    if (!pool->workers) { perror("calloc"); return -1; }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    int cpus[CPU_SETSIZE], ncpus = 0;
+    cpu_set_t allowed;
+    if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed)) cpus[ncpus++] = c;
+    }
+
+    for (int i = 0; i < count; i++) {
+        pool_worker_t *w = &pool->workers[i];
+        w->pool = pool;
+        w->pinned_cpu = -1;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (ncpus > 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpus[i % ncpus], &one);
+            if (pthread_attr_setaffinity_np(&attr, sizeof(one), &one) == 0)
+                w->pinned_cpu = cpus[i % ncpus];
+        }
+        int err = pthread_create(&w->thread, &attr, pool_worker, w);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create failed for worker %d\n", i);
+            pool->count = i;
+            pool_destroy(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Run a job made of several segments (e.g. a batch of small files). Each
+// segment is a thread_job_t with start = 0 and end = its size. Blocks
+// until every segment is transformed. If seg_crc is set it receives the
+// input/output CRC32C of every segment.
+void pool_run_segments(worker_pool_t *pool, const thread_job_t *segs, int nsegs,
+                       crc_pair_t *seg_crc) {
+    size_t *bases = malloc((nsegs > 0 ? nsegs : 1) * sizeof(size_t));
+    if (!bases) { perror("malloc"); return; }
+    size_t total = 0;
+    for (int i = 0; i < nsegs; i++) {
+        bases[i] = total;
+        total += segs[i].end;
+    }
+    if (total == 0) { free(bases); return; }
+
+    size_t ngrains = (total + pool->grain - 1) / pool->grain;
+    crc_pair_t *pieces = NULL;
+    if (seg_crc && !(pieces = calloc(ngrains + nsegs, sizeof(*pieces)))) {
+        perror("calloc");
+        free(bases);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->crcs = pieces;
+    pool->segs = segs;
+    pool->bases = bases;
+    pool->nsegs = nsegs;
+    pool->total = total;
+    atomic_store(&pool->cursor, 0);
+    pool->active = pool->count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    while (pool->active > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pool->crcs = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    // Fold the pieces of each segment together in file order
+    for (int i = 0; pieces && i < nsegs; i++) {
+        size_t seg_start = bases[i], seg_end = bases[i] + segs[i].end;
+        crc_pair_t c = {0, 0};
+        for (size_t g = seg_start / pool->grain; g * pool->grain < seg_end; g++) {
+            size_t lo = g * pool->grain > seg_start ? g * pool->grain : seg_start;
+            size_t hi = (g + 1) * pool->grain < seg_end ? (g + 1) * pool->grain : seg_end;
+            c.in = crc32c_combine(c.in, pieces[g + i].in, hi - lo);
+            c.out = crc32c_combine(c.out, pieces[g + i].out, hi - lo);
+        }
+        seg_crc[i] = c;
+    }
+    free(pieces);
+    free(bases);
+}
+
+// Transform src[0, size) into data using every worker; blocks until done.
+// offset is the stream position of src[0]. crc (optional) receives the
+// CRC32C of the input and output bytes.
+void pool_run(worker_pool_t *pool, unsigned char *data, const unsigned char *src,
+              size_t size, uint64_t offset, const crypt_params_t *params, crc_pair_t *crc) {
+    thread_job_t seg = { data, src, 0, size, offset, params, 0 };
+    pool_run_segments(pool, &seg, 1, crc);
+}
+
+void pool_destroy(worker_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+}
+
+// Per-worker bytes processed and placement, so scheduling imbalance and
+// cross-node workers are visible
+void pool_report(const worker_pool_t *pool) {
+    size_t total = 0, max = 0;
+    for (int i = 0; i < pool->count; i++) {
+        total += pool->workers[i].bytes;
+        if (pool->workers[i].bytes > max) max = pool->workers[i].bytes;
+    }
+    printf("[+] Per-worker bytes:\n");
+    for (int i = 0; i < pool->count; i++) {
+        const pool_worker_t *w = &pool->workers[i];
+        printf("    worker %-3d %14zu (%5.1f%%)  cpu %-3u node %u%s\n", i, w->bytes,
+               total ? 100.0 * w->bytes / total : 0.0, w->cpu, w->node,
+               w->pinned_cpu >= 0 ? " (pinned)" : "");
+    }
+    if (total)
+        printf("[+] Imbalance (max/mean): %.2f\n", (double)max * pool->count / total);
+}
+
+// ---------------------------- FULL READ / WRITE ----------------------------
+// read() until len bytes or EOF; returns bytes read or -1
+ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// write() all len bytes; returns 0 or -1
+int write_full(int fd, const unsigned char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// ---------------------------- LARGE BUFFERS ----------------------------
+// Anonymous mappings aligned to HUGE_PAGE and marked MADV_HUGEPAGE, so
+// transparent huge pages can back them and a multi-GB buffer costs a few
+// thousand TLB entries instead of a million. Pages are not touched here:
+// whichever worker writes a page first gets it on its own NUMA node.
+void *buffer_alloc(size_t size) {
+    size_t span = size + HUGE_PAGE;
+    unsigned char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    // Trim to a HUGE_PAGE-aligned start; the slack is returned at once
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char *p = (unsigned char *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+    size_t len = (size + page - 1) & ~(page - 1);
+    if (p > raw) munmap(raw, p - raw);
+    if (raw + span > p + len) munmap(p + len, raw + span - (p + len));
+
+    if (size >= HUGE_PAGE) madvise(p, len, MADV_HUGEPAGE);
+    return p;
+}
+
+void buffer_free(void *p, size_t size) {
+    if (p) munmap(p, size);
+}
+
+// Bytes of the mapping holding p that are backed by huge pages, from
+// /proc/self/smaps (0 if unknown)
+size_t buffer_huge_bytes(const void *p) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (!f) return 0;
+    char line[256];
+    int inside = 0;
+    size_t kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long lo, hi;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2 && strchr(line, '-') < strchr(line, ' '))
+            inside = (uintptr_t)p >= lo && (uintptr_t)p < hi;
+        else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb << 10;
+}
+
+// ---------------------------- STREAMING PIPELINE ----------------------------
+// Reader stage: fills free slots in order until EOF, error or signal
+void *stream_reader(void *arg) {
+    stream_ctx_t *ctx = (stream_ctx_t *)arg;
+
+    for (size_t seq = 0; ; seq++) {
+        stream_slot_t *slot = &ctx->slots[seq % STREAM_SLOTS];
+
+        pthread_mutex_lock(&ctx->lock);
+        while (slot->state != SLOT_FREE && !ctx->error && !ctx->closed)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        int failed = ctx->error || ctx->closed;
+        pthread_mutex_unlock(&ctx->lock);
+        if (failed) return NULL;
+
+        ssize_t n = 0;
+        if (!stop_requested)
+            n = read_full(ctx->in_fd, slot->data, ctx->chunk_size);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (n < 0) {
+            ctx->error = errno;
+            n = 0;
+        }
+        slot->len = n;
+        slot->last = (n < (ssize_t)ctx->chunk_size) || stop_requested;
+        slot->state = SLOT_FILLED;
+        int last = slot->last;
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (last) return NULL;
+    }
+}
+
+// Writer stage: drains transformed slots in order
+void *stream_writer(void *arg) {
+    stream_ctx_t *ctx = (stream_ctx_t *)arg;
+
+    for (size_t seq = 0; ; seq++) {
+        stream_slot_t *slot = &ctx->slots[seq % STREAM_SLOTS];
+
+        pthread_mutex_lock(&ctx->lock);
+        while (slot->state != SLOT_TRANSFORMED && !ctx->error)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        int failed = ctx->error;
+        pthread_mutex_unlock(&ctx->lock);
+        if (failed) return NULL;
+
+        int rc = write_full(ctx->out_fd, slot->data, slot->len);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (rc < 0) ctx->error = errno;
+        else ctx->bytes_written += slot->len;
+        slot->state = SLOT_FREE;
+        int last = slot->last;
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (last || rc < 0) return NULL;
+    }
+}
+
+// Run the pipeline; the calling thread is the transform stage.
+// Peak memory is STREAM_SLOTS * chunk_size regardless of file size.
+int stream_file(int in_fd, int out_fd, size_t chunk_size, worker_pool_t *pool,
+                const crypt_params_t *params, size_t *processed, crc_pair_t *crc) {
+    stream_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.in_fd = in_fd;
+    ctx.out_fd = out_fd;
+    ctx.chunk_size = chunk_size;
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        ctx.slots[i].data = buffer_alloc(chunk_size);
+        if (!ctx.slots[i].data) {
+            perror("mmap");
+            for (int j = 0; j < i; j++) buffer_free(ctx.slots[j].data, chunk_size);
+            return -1;
+        }
+    }
+
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Larger pipe buffers mean fewer wakeups between us and our neighbours
+    // in a pipeline; these fail harmlessly on regular files
+    fcntl(in_fd, F_SETPIPE_SZ, PIPE_SIZE);
+    fcntl(out_fd, F_SETPIPE_SZ, PIPE_SIZE);
+
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, stream_reader, &ctx);
+    pthread_create(&writer, NULL, stream_writer, &ctx);
+
+    for (size_t seq = 0; ; seq++) {
+        stream_slot_t *slot = &ctx.slots[seq % STREAM_SLOTS];
+
+        pthread_mutex_lock(&ctx.lock);
+        while (slot->state != SLOT_FILLED && !ctx.error)
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+        int failed = ctx.error;
+        pthread_mutex_unlock(&ctx.lock);
+        if (failed) break;
+
+        if (slot->len > 0) {
+            crc_pair_t c;
+            pool_run(pool, slot->data, slot->data, slot->len,
+                     (uint64_t)seq * chunk_size, params, crc ? &c : NULL);
+            if (crc) {
+                crc->in = crc32c_combine(crc->in, c.in, slot->len);
+                crc->out = crc32c_combine(crc->out, c.out, slot->len);
+            }
+        }
+
+        // A chunk cut short by a signal is dropped so the output only
+        // ever holds fully transformed chunks.
+        pthread_mutex_lock(&ctx.lock);
+        if (stop_requested) {
+            slot->len = 0;
+            slot->last = 1;
+        }
+        slot->state = SLOT_TRANSFORMED;
+        int last = slot->last;
+        pthread_cond_broadcast(&ctx.cond);
+        pthread_mutex_unlock(&ctx.lock);
+
+        if (last) break;
+    }
+
+    // Release the reader if it is still waiting for a free slot
+    pthread_mutex_lock(&ctx.lock);
+    ctx.closed = 1;
+    pthread_cond_broadcast(&ctx.cond);
+    pthread_mutex_unlock(&ctx.lock);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    for (int i = 0; i < STREAM_SLOTS; i++) buffer_free(ctx.slots[i].data, chunk_size);
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.cond);
+
+    *processed = ctx.bytes_written;
+    if (ctx.error) {
+        errno = ctx.error;
+        perror("stream");
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------- DIRECT I/O ----------------------------
+// --direct bypasses the page cache: files are opened with O_DIRECT and
+// every transfer is DIRECT_ALIGN-aligned in offset, length and address.
+// Up to depth chunks are in flight at once through an io_uring set up
+// with raw syscalls; while the pool transforms one chunk, the kernel keeps
+// reading and writing the others. Without io_uring the same loop runs on
+// synchronous pread/pwrite.
+
+// Submission/completion rings shared with the kernel
+typedef struct {
+    int fd;                    // io_uring fd, -1 = synchronous fallback
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+    uint64_t *done_tag;        // fallback: finished requests, in order
+    int *done_res;
+    int ndone;
+} dio_ring_t;
+
+// One chunk of output and the input window it is computed from
+typedef struct {
+    unsigned char *in;         // read window, chunk + 2 * DIRECT_ALIGN
+    unsigned char *out;        // transformed chunk
+    uint64_t index;            // output chunk number
+    uint64_t in_off;           // aligned file offset of in[0]
+    size_t in_need;            // bytes of the window that must be read
+    size_t in_len;             // bytes requested (aligned)
+    size_t out_len;            // bytes to write (aligned)
+    size_t done;               // bytes transferred so far
+    int writing;
+} dio_slot_t;
+
+int dio_ring_init(dio_ring_t *r, unsigned depth) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->done_tag = calloc(depth, sizeof(*r->done_tag));
+    r->done_res = calloc(depth, sizeof(*r->done_res));
+    if (!r->done_tag || !r->done_res) {
+        perror("calloc");
+        free(r->done_tag);
+        free(r->done_res);
+        return -1;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0) return 0;   // ENOSYS, EPERM (seccomp), ...: fall back
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+    r->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_ring
+               : mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        perror("mmap io_uring");
+        close(fd);
+        free(r->done_tag);
+        free(r->done_res);
+        return -1;
+    }
+
+    unsigned char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->fd = fd;
+    return 0;
+}
+
+void dio_ring_close(dio_ring_t *r) {
+    if (r->fd >= 0) {
+        munmap(r->sqes, r->sqes_size);
+        if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_size);
+        munmap(r->sq_ring, r->sq_size);
+        close(r->fd);
+    }
+    free(r->done_tag);
+    free(r->done_res);
+}
+
+// Queue one read or write. The fallback does it on the spot and keeps the
+// result for dio_wait(), so the caller sees the same completion stream.
+int dio_submit(dio_ring_t *r, int fd, int write, void *buf, size_t len, uint64_t off,
+               uint64_t tag) {
+    if (r->fd < 0) {
+        ssize_t n = write ? pwrite(fd, buf, len, off) : pread(fd, buf, len, off);
+        r->done_tag[r->ndone] = tag;
+        r->done_res[r->ndone++] = n < 0 ? -errno : (int)n;
+        return 0;
+    }
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) { perror("io_uring_enter"); return -1; }
+    }
+    return 0;
+}
+
+// Block until a request finishes; res is bytes transferred or -errno
+int dio_wait(dio_ring_t *r, uint64_t *tag, int *res) {
+    if (r->fd < 0) {
+        if (r->ndone == 0) return -1;
+        *tag = r->done_tag[0];
+        *res = r->done_res[0];
+        r->ndone--;
+        memmove(r->done_tag, r->done_tag + 1, r->ndone * sizeof(*r->done_tag));
+        memmove(r->done_res, r->done_res + 1, r->ndone * sizeof(*r->done_res));
+        return 0;
+    }
+    unsigned head = *r->cq_head;
+    // EINTR (our own SIGINT handler) just means wait again: the requests
+    // in flight still have to be reaped before their buffers are freed
+    while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    }
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#define ALIGN_DOWN(x) ((x) & ~(uint64_t)(DIRECT_ALIGN - 1))
+#define ALIGN_UP(x) ALIGN_DOWN((x) + DIRECT_ALIGN - 1)
+
+// Layout shared by every chunk of one direct_file() run
+typedef struct {
+    int in_fd, out_fd;
+    size_t chunk;
+    uint64_t out_size;     // header + payload
+    size_t in_skip;        // input header bytes
+    size_t out_skip;       // output header bytes
+} dio_layout_t;
+
+// Output bytes [lo, hi) of chunk c and the payload offset plo they start at
+void dio_chunk_range(const dio_layout_t *l, uint64_t c, uint64_t *lo, uint64_t *hi,
+                     uint64_t *plo) {
+    *lo = c * l->chunk;
+    *hi = *lo + l->chunk < l->out_size ? *lo + l->chunk : l->out_size;
+    *plo = *lo > l->out_skip ? *lo - l->out_skip : 0;
+}
+
+// Start reading the aligned input window that holds chunk s->index
+int dio_read_chunk(dio_ring_t *r, const dio_layout_t *l, dio_slot_t *s, uint64_t tag) {
+    uint64_t lo, hi, plo;
+    dio_chunk_range(l, s->index, &lo, &hi, &plo);
+    uint64_t need_end = hi - l->out_skip + l->in_skip;
+    s->in_off = ALIGN_DOWN(plo + l->in_skip);
+    s->in_need = need_end - s->in_off;
+    s->in_len = ALIGN_UP(need_end) - s->in_off;
+    s->done = 0;
+    s->writing = 0;
+    return dio_submit(r, l->in_fd, 0, s->in, s->in_len, s->in_off, tag);
+}
+
+// Encrypt or decrypt data_size payload bytes that start at in_skip in the
+// input into an output that starts with hdr (if any). Output chunks are
+// aligned to the output file; each one reads the aligned input window
+// holding its payload, so a chacha20 header on either side costs one
+// extra block per chunk instead of a copy. written gets the length of the
+// finished prefix of payload, which is what a journal may record.
+int direct_file(int in_fd, int out_fd, uint64_t data_size, size_t in_skip,
+                const file_header_t *hdr, size_t chunk, int depth, worker_pool_t *pool,
+                const crypt_params_t *params, size_t *written, crc_pair_t *crc,
+                const char **io) {
+    dio_layout_t l = { in_fd, out_fd, chunk, 0, in_skip, hdr ? sizeof(*hdr) : 0 };
+    l.out_size = data_size + l.out_skip;
+    uint64_t nchunks = (l.out_size + chunk - 1) / chunk;
+    if ((uint64_t)depth > nchunks) depth = (int)nchunks;
+    *written = 0;
+
+    dio_ring_t ring;
+    if (dio_ring_init(&ring, depth) < 0) return -1;
+    *io = ring.fd >= 0 ? "io_uring" : "pread/pwrite";
+
+    dio_slot_t *slots = calloc(depth, sizeof(*slots));
+    unsigned char *finished = calloc(nchunks, 1);
+    crc_pair_t *chunk_crc = crc ? calloc(nchunks, sizeof(*chunk_crc)) : NULL;
+    int err = (!slots || !finished || (crc && !chunk_crc)) ? ENOMEM : 0;
+    for (int i = 0; i < depth && !err; i++) {
+        slots[i].in = buffer_alloc(chunk + 2 * DIRECT_ALIGN);
+        slots[i].out = buffer_alloc(chunk);
+        if (!slots[i].in || !slots[i].out) err = ENOMEM;
+    }
+
+    uint64_t next = 0;
+    int inflight = 0;
+    for (int i = 0; i < depth && !err; i++) {
+        slots[i].index = next++;
+        if (dio_read_chunk(&ring, &l, &slots[i], i) < 0) err = EIO;
+        else inflight++;
+    }
+
+    while (inflight > 0) {
+        uint64_t tag;
+        int res;
+        if (dio_wait(&ring, &tag, &res) < 0) { err = EIO; break; }
+        dio_slot_t *s = &slots[tag];
+        inflight--;
+        if (res < 0) { if (!err) err = -res; continue; }
+        s->done += res;
+
+        uint64_t lo, hi, plo;
+        dio_chunk_range(&l, s->index, &lo, &hi, &plo);
+        int again;
+
+        if (!s->writing) {
+            // A short read before the data we need is resubmitted; at EOF
+            // it means the input shrank under us
+            if (s->done < s->in_need) {
+                if (res == 0) { if (!err) err = EIO; continue; }
+                again = dio_submit(&ring, in_fd, 0, s->in + s->done, s->in_len - s->done,
+                                   s->in_off + s->done, tag);
+            } else {
+                if (err || stop_requested) continue;
+                size_t dst = lo < l.out_skip ? l.out_skip - lo : 0;
+                if (dst) memcpy(s->out, hdr, l.out_skip);
+                pool_run(pool, s->out + dst, s->in + (plo + in_skip - s->in_off),
+                         hi - l.out_skip - plo, plo, params,
+                         chunk_crc ? &chunk_crc[s->index] : NULL);
+                if (stop_requested) continue;   // cut short: never write it
+
+                // The tail is written padded to DIRECT_ALIGN and truncated later
+                s->out_len = ALIGN_UP(hi - lo);
+                s->done = 0;
+                s->writing = 1;
+                again = dio_submit(&ring, out_fd, 1, s->out, s->out_len, lo, tag);
+            }
+        } else if (s->done < s->out_len) {
+            if (res == 0) { if (!err) err = EIO; continue; }
+            again = dio_submit(&ring, out_fd, 1, s->out + s->done, s->out_len - s->done,
+                               lo + s->done, tag);
+        } else {
+            finished[s->index] = 1;
+            if (next >= nchunks || err || stop_requested) continue;
+            s->index = next++;
+            again = dio_read_chunk(&ring, &l, s, tag);
+        }
+        if (again < 0) err = EIO;
+        else inflight++;
+    }
+
+    // Only the leading run of finished chunks counts as written
+    uint64_t prefix = 0;
+    while (finished && prefix < nchunks && finished[prefix]) prefix++;
+    uint64_t out_done = prefix * chunk < l.out_size ? prefix * chunk : l.out_size;
+    *written = out_done > l.out_skip ? out_done - l.out_skip : 0;
+
+    int rc = 0;
+    if (err) {
+        errno = err;
+        perror("direct I/O");
+        rc = -1;
+    } else if (prefix == nchunks) {
+        if (ftruncate(out_fd, l.out_size) < 0) { perror("ftruncate"); rc = -1; }
+        for (uint64_t c = 0; crc && c < nchunks; c++) {
+            uint64_t lo, hi, plo;
+            dio_chunk_range(&l, c, &lo, &hi, &plo);
+            crc->in = crc32c_combine(crc->in, chunk_crc[c].in, hi - l.out_skip - plo);
+            crc->out = crc32c_combine(crc->out, chunk_crc[c].out, hi - l.out_skip - plo);
+        }
+    } else if (fdatasync(out_fd) < 0) {
+        // Interrupted: the journal about to be written must not get ahead
+        perror("fdatasync");
+        rc = -1;
+    }
+
+    dio_ring_close(&ring);
+    for (int i = 0; slots && i < depth; i++) {
+        buffer_free(slots[i].in, chunk + 2 * DIRECT_ALIGN);
+        buffer_free(slots[i].out, chunk);
+    }
+    free(slots);
+    free(finished);
+    free(chunk_crc);
+    return rc;
+}
+
+// ---------------------------- ZERO-COPY MAPPED MODE ----------------------------
+// Workers read the input mapping and write straight into a MAP_SHARED
+// mapping of the output, so there is no malloc'd copy and no write().
+// When output is the same file as input the transform runs in place.
+// in_skip input header bytes are skipped; hdr (if any) is written first.
+int map_file(int in_fd, const char *output, const struct stat *in_st,
+             worker_pool_t *pool, const crypt_params_t *params,
+             size_t in_skip, const file_header_t *hdr, journal_t *j,
+             int resume, int *in_place, crc_pair_t *crc) {
+    size_t size = in_st->st_size - in_skip;
+    size_t out_skip = hdr ? sizeof(*hdr) : 0;
+    size_t out_size = size + out_skip;
+    struct stat out_st;
+
+    *in_place = stat(output, &out_st) == 0 &&
+                out_st.st_dev == in_st->st_dev && out_st.st_ino == in_st->st_ino;
+    if (*in_place && (in_skip || hdr)) {
+        fprintf(stderr, "In-place mode needs --cipher caesar (chacha20 adds a header).\n");
+        return -1;
+    }
+
+    int out_fd;
+    if (*in_place) {
+        // Same inode: must not truncate, reopen the input read/write instead
+        out_fd = open(output, O_RDWR);
+        if (out_fd < 0) { perror("open output"); return -1; }
+    } else {
+        // A resumed output keeps its finished chunks; it may be short if
+        // the interrupted run was streaming
+        out_fd = open(output, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0600);
+        if (out_fd < 0) { perror("open output"); return -1; }
+        if (ftruncate(out_fd, out_size) < 0) {
+            perror("ftruncate");
+            close(out_fd);
+            return -1;
+        }
+    }
+
+    unsigned char *dst = mmap(NULL, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if (dst == MAP_FAILED) { perror("mmap output"); close(out_fd); return -1; }
+
+    const unsigned char *src = dst;
+    unsigned char *in_map = NULL;
+    if (!*in_place) {
+        in_map = mmap(NULL, in_st->st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (in_map == MAP_FAILED) {
+            perror("mmap input");
+            munmap(dst, out_size);
+            close(out_fd);
+            return -1;
+        }
+        madvise(in_map, in_st->st_size, MADV_SEQUENTIAL);
+        src = in_map + in_skip;
+    }
+    madvise(dst, out_size, MADV_SEQUENTIAL);
+
+    if (hdr) memcpy(dst, hdr, out_skip);
+    pool->done = j ? j->bits : NULL;
+    pool_run(pool, dst + out_skip, src, size, 0, params, crc);
+    pool->done = NULL;
+
+    int rc = 0;
+    if (msync(dst, out_size, MS_SYNC) < 0) { perror("msync"); rc = -1; }
+
+    munmap(dst, out_size);
+    if (in_map) munmap(in_map, in_st->st_size);
+    close(out_fd);
+    return rc;
+}
+
+// Parse a byte count with an optional K/M/G suffix
+size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+        case 'K': v <<= 10; break;
+        case 'M': v <<= 20; break;
+        case 'G': v <<= 30; break;
+        case '\0': break;
+        default: return 0;
+    }
+    return (size_t)v;
+}
+
+// ---------------------------- RESUME JOURNAL ----------------------------
+// A bitmap of finished POOL_GRAIN chunks, saved next to the output as
+// <output>.fcj when a run is interrupted. --resume reloads it and the pool
+// skips chunks whose bit is set. The output data is flushed before the
+// journal is written, so a set bit always means the chunk is on disk.
+int journal_init(journal_t *j, uint64_t data_size) {
+    j->data_size = data_size;
+    j->nchunks = (data_size + POOL_GRAIN - 1) / POOL_GRAIN;
+    j->bits = calloc((j->nchunks + 63) / 64 + 1, sizeof(*j->bits));
+    if (!j->bits) { perror("calloc"); return -1; }
+    return 0;
+}
+
+void journal_path(const char *output, char *buf, size_t len) {
+    snprintf(buf, len, "%s%s", output, JOURNAL_SUFFIX);
+}
+
+size_t journal_done(const journal_t *j) {
+    size_t n = 0;
+    for (size_t i = 0; i < (j->nchunks + 63) / 64; i++)
+        n += __builtin_popcountll(atomic_load(&j->bits[i]));
+    return n;
+}
+
+// Mark the first n payload bytes as done (streaming writes a prefix)
+void journal_mark_prefix(journal_t *j, uint64_t n) {
+    size_t full = n >= j->data_size ? j->nchunks : n / POOL_GRAIN;
+    for (size_t c = 0; c < full; c++)
+        atomic_fetch_or(&j->bits[c / 64], 1ULL << (c % 64));
+}
+
+// Fingerprint of the key so a resume with another key is refused instead
+// of leaving a file encrypted under two keys. For chacha20 it is keyed by
+// the derived key, never the passphrase itself.
+void journal_key_check(const crypt_params_t *p, uint8_t out[8]) {
+    static const char label[] = "filecrypt journal key check";
+    unsigned char mac[32];
+    if (p->cipher == CIPHER_CHACHA20) {
+        hmac_sha256((const unsigned char *)&p->chacha[4], 32,
+                    (const unsigned char *)label, sizeof(label) - 1, mac);
+    } else {
+        unsigned char key = (unsigned char)p->key;
+        hmac_sha256(&key, 1, (const unsigned char *)label, sizeof(label) - 1, mac);
+    }
+    memcpy(out, mac, 8);
+}
+
+// The journal must have been written under the key of this run
+int journal_key_matches(const journal_t *j, const char *output, const crypt_params_t *p) {
+    uint8_t check[8];
+    journal_key_check(p, check);
+    if (memcmp(check, j->key_check, sizeof(check)) == 0) return 1;
+
+    char path[PATH_MAX];
+    journal_path(output, path, sizeof(path));
+    fprintf(stderr, "%s was written with a different key; resume with the original key.\n", path);
+    return 0;
+}
+
+int journal_save(const journal_t *j, const char *output, const crypt_params_t *p) {
+    char path[PATH_MAX];
+    journal_path(output, path, sizeof(path));
+
+    journal_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, JOURNAL_MAGIC, 4);
+    h.chunk_size = POOL_GRAIN;
+    h.data_size = j->data_size;
+    h.cipher = p->cipher;
+    h.encrypt = p->encrypt;
+    journal_key_check(p, h.key_check);
+
+    size_t words = (j->nchunks + 63) / 64;
+    uint64_t *plain = malloc(words * sizeof(uint64_t) + 1);
+    if (!plain) { perror("malloc"); return -1; }
+    for (size_t i = 0; i < words; i++) plain[i] = atomic_load(&j->bits[i]);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int rc = fd < 0 ? -1 : 0;
+    if (rc == 0 && (write_full(fd, (const unsigned char *)&h, sizeof(h)) < 0 ||
+                    write_full(fd, (const unsigned char *)plain, words * sizeof(uint64_t)) < 0 ||
+                    fsync(fd) < 0))
+        rc = -1;
+    if (rc < 0) perror(path);
+    if (fd >= 0) close(fd);
+    free(plain);
+    return rc;
+}
+
+// Load the journal of an interrupted run; it must describe the same job
+int journal_load(journal_t *j, const char *output, const crypt_params_t *p) {
+    char path[PATH_MAX];
+    journal_path(output, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+
+    journal_header_t h;
+    size_t words = (j->nchunks + 63) / 64;
+    uint64_t *plain = malloc(words * sizeof(uint64_t) + 1);
+    int rc = plain ? 0 : -1;
+    if (rc == 0 && (read_full(fd, (unsigned char *)&h, sizeof(h)) != sizeof(h) ||
+                    memcmp(h.magic, JOURNAL_MAGIC, 4) != 0 ||
+                    h.chunk_size != POOL_GRAIN || h.data_size != j->data_size ||
+                    h.cipher != p->cipher || h.encrypt != p->encrypt ||
+                    read_full(fd, (unsigned char *)plain, words * sizeof(uint64_t)) !=
+                        (ssize_t)(words * sizeof(uint64_t)))) {
+        fprintf(stderr, "%s does not match this input, cipher and direction.\n", path);
+        rc = -1;
+    }
+    if (rc == 0) {
+        for (size_t i = 0; i < words; i++) atomic_store(&j->bits[i], plain[i]);
+        memcpy(j->key_check, h.key_check, sizeof(j->key_check));
+    }
+    free(plain);
+    close(fd);
+    return rc;
+}
+
+// After an interrupt: persist the journal and tell the user how to resume
+void journal_checkpoint(const journal_t *j, const char *output, const crypt_params_t *p) {
+    char path[PATH_MAX];
+    journal_path(output, path, sizeof(path));
+    if (journal_save(j, output, p) == 0)
+        fprintf(stderr, "[!] %zu of %zu chunks done; journal saved to %s. Rerun with --resume.\n",
+                journal_done(j), j->nchunks, path);
+}
+
+void journal_remove(const char *output) {
+    char path[PATH_MAX];
+    journal_path(output, path, sizeof(path));
+    unlink(path);
+}
+
+// ---------------------------- CHECKSUM SIDECAR ----------------------------
+// Encrypting to a file writes <output>.fcsum holding the CRC32C of both the
+// plaintext and the ciphertext. Decrypting a file that has one checks the
+// ciphertext as it is read and the plaintext as it is produced, so a
+// damaged file and a wrong key are both reported.
+//
+// CRC32C is linear, so a readable plaintext CRC next to chacha20 output
+// would let anyone holding the ciphertext test guesses about the content.
+// For chacha20 the sidecar stores an HMAC of the CRC under the derived key
+// instead; a wrong key still shows up as a mismatch. Caesar keeps the CRC.
+void sum_path(const char *file, char *buf, size_t len) {
+    snprintf(buf, len, "%s%s", file, SUM_SUFFIX);
+}
+
+uint32_t checksum_plain_tag(const crypt_params_t *p, uint32_t crc, uint64_t size) {
+    if (p->cipher != CIPHER_CHACHA20) return crc;
+    static const char label[] = "filecrypt plaintext check";
+    unsigned char msg[sizeof(label) - 1 + 8 + 4 + 8], mac[32];
+    size_t n = sizeof(label) - 1;
+    memcpy(msg, label, n);
+    memcpy(msg + n, &p->chacha[14], 8);    // nonce
+    memcpy(msg + n + 8, &crc, 4);
+    memcpy(msg + n + 12, &size, 8);
+    hmac_sha256((const unsigned char *)&p->chacha[4], 32, msg, sizeof(msg), mac);
+    uint32_t tag;
+    memcpy(&tag, mac, 4);
+    return tag;
+}
+
+int checksum_save(const char *output, const crypt_params_t *p, uint64_t size,
+                  const crc_pair_t *crc) {
+    char path[PATH_MAX];
+    sum_path(output, path, sizeof(path));
+
+    checksum_file_t c;
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magic, SUM_MAGIC, 4);
+    c.cipher = p->cipher;
+    c.plain_crc = checksum_plain_tag(p, crc->in, size);
+    c.cipher_crc = crc->out;
+    c.data_size = size;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int rc = fd < 0 || write_full(fd, (const unsigned char *)&c, sizeof(c)) < 0 ? -1 : 0;
+    if (rc < 0) perror(path);
+    if (fd >= 0) close(fd);
+    return rc;
+}
+
+// Returns 1 if input matched its sidecar, 0 if it has none, -1 on mismatch
+int checksum_check(const char *input, const crypt_params_t *p, uint64_t size,
+                   const crc_pair_t *crc) {
+    char path[PATH_MAX];
+    sum_path(input, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    checksum_file_t c;
+    ssize_t n = read_full(fd, (unsigned char *)&c, sizeof(c));
+    close(fd);
+
+    if (n != sizeof(c) || memcmp(c.magic, SUM_MAGIC, 4) != 0 || c.cipher != p->cipher) {
+        fprintf(stderr, "%s is not a checksum file for this cipher.\n", path);
+        return -1;
+    }
+    if (c.data_size != size || c.cipher_crc != crc->in) {
+        fprintf(stderr, "[!] %s: ciphertext does not match %s (file damaged)\n", input, path);
+        return -1;
+    }
+    if (c.plain_crc != checksum_plain_tag(p, crc->out, size)) {
+        fprintf(stderr, "[!] %s: decrypted data does not match %s (wrong key?)\n", input, path);
+        return -1;
+    }
+    return 1;
+}
+
+// Record the CRCs of a finished crypt_file() run and write or check the
+// sidecar. Resumed and interrupted runs have no whole-file CRC, so a
+// sidecar left by an earlier encryption of the output is removed.
+int checksum_finish(const char *input, const char *output, const crypt_params_t *p,
+                    const crc_pair_t *crc, file_result_t *res) {
+    if (crc && !stop_requested) {
+        res->has_crc = 1;
+        res->crc = *crc;
+    }
+    if (p->encrypt) {
+        if (strcmp(output, "-") == 0) return 0;
+        if (res->has_crc) return checksum_save(output, p, res->written, crc);
+        char path[PATH_MAX];
+        sum_path(output, path, sizeof(path));
+        unlink(path);
+        return 0;
+    }
+    if (!res->has_crc || strcmp(input, "-") == 0) return 0;
+    int r = checksum_check(input, p, res->written, crc);
+    res->verified = r > 0;
+    return r < 0 ? -1 : 0;
+}
+
+// ---------------------------- SPARSE FILES ----------------------------
+// With --sparse the data extents of the input are found with
+// lseek(SEEK_DATA/SEEK_HOLE) and handed to the pool as the segments of one
+// job, so holes are never read, transformed or written. Neither cipher
+// maps zeros to zeros, so the holes are recorded in <output>.fcmap; a
+// decrypt of a file with such a map transforms exactly those extents
+// and leaves the rest of the output as holes (plaintext zeros).
+void map_path(const char *file, char *buf, size_t len) {
+    snprintf(buf, len, "%s%s", file, MAP_SUFFIX);
+}
+
+// Data extents of fd within [skip, skip + size), as payload offsets
+int find_extents(int fd, uint64_t skip, uint64_t size, extent_t **out, size_t *count) {
+    size_t n = 0, cap = 16;
+    extent_t *e = malloc(cap * sizeof(*e));
+    if (!e) { perror("malloc"); return -1; }
+
+    off_t end = (off_t)(skip + size), pos = (off_t)skip;
+    while (pos < end) {
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) break;      // only a hole is left
+        if (data < 0) { perror("lseek SEEK_DATA"); free(e); return -1; }
+        if (data >= end) break;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) { perror("lseek SEEK_HOLE"); free(e); return -1; }
+        if (hole > end) hole = end;
+
+        if (n == cap) {
+            extent_t *bigger = realloc(e, 2 * cap * sizeof(*e));
+            if (!bigger) { perror("realloc"); free(e); return -1; }
+            e = bigger;
+            cap *= 2;
+        }
+        e[n].offset = data - skip;
+        e[n].length = hole - data;
+        n++;
+        pos = hole;
+    }
+    *out = e;
+    *count = n;
+    return 0;
+}
+
+int extent_map_save(const char *output, const extent_t *e, size_t n, uint64_t data_size) {
+    char path[PATH_MAX];
+    map_path(output, path, sizeof(path));
+
+    extent_map_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAP_MAGIC, 4);
+    h.data_size = data_size;
+    h.count = n;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int rc = fd < 0 || write_full(fd, (const unsigned char *)&h, sizeof(h)) < 0 ||
+             write_full(fd, (const unsigned char *)e, n * sizeof(*e)) < 0 ? -1 : 0;
+    if (rc < 0) perror(path);
+    if (fd >= 0) close(fd);
+    return rc;
+}
+
+// A map left by an earlier sparse run would be wrong for new output
+int extent_map_drop(const char *output) {
+    char path[PATH_MAX];
+    map_path(output, path, sizeof(path));
+    if (unlink(path) < 0 && errno != ENOENT) { perror(path); return -1; }
+    return 0;
+}
+
+// Returns 1 and the extents if input has a map, 0 if it has none, -1 if
+// the map is unreadable or does not fit the input
+int extent_map_load(const char *input, uint64_t data_size, extent_t **out, size_t *count) {
+    char path[PATH_MAX];
+    map_path(input, path, sizeof(path));
 
-// Thread job structure
-typedef struct {
-    unsigned char *data;
-    size_t start;
-    size_t end;
-    int key;
-    int encrypt; // 1 = encrypt, 0 = decrypt
-} thread_job_t;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
 
-// ---------------------------- SIGNAL HANDLING ----------------------------
-void signal_handler(int sig) {
-    stop_requested = 1;
-    fprintf(stderr, "\n[!] Signal received (%d). Stopping safely...\n", sig);
+    extent_map_header_t h;
+    extent_t *e = NULL;
+    int rc = read_full(fd, (unsigned char *)&h, sizeof(h)) == sizeof(h) &&
+             memcmp(h.magic, MAP_MAGIC, 4) == 0 && h.data_size == data_size &&
+             h.count <= data_size ? 1 : -1;
+    if (rc > 0) {
+        e = malloc((h.count + 1) * sizeof(*e));
+        if (!e || read_full(fd, (unsigned char *)e, h.count * sizeof(*e)) !=
+                      (ssize_t)(h.count * sizeof(*e)))
+            rc = -1;
+    }
+    // Extents must be sorted, disjoint and inside the payload
+    for (uint64_t i = 0, end = 0; rc > 0 && i < h.count; i++) {
+        if (e[i].offset < end || e[i].length > data_size - e[i].offset) rc = -1;
+        end = e[i].offset + e[i].length;
+    }
+    close(fd);
+
+    if (rc < 0) {
+        fprintf(stderr, "%s does not describe this input.\n", path);
+        free(e);
+        return -1;
+    }
+    *out = e;
+    *count = h.count;
+    return 1;
 }
 
-// ---------------------------- SECURE KEY ENTRY ----------------------------
-int secure_get_key() {
-    struct termios oldt, newt;
-    char buf[32];
+// CRC32C of n zero bytes: the data adds nothing, only the initial ~0
+// state is carried forward
+uint32_t crc32c_zeros(uint64_t n) {
+    return ~crc32c_multmodp(crc32c_shift(n), 0xffffffffU);
+}
 
-    printf("Enter key (number): ");
-    fflush(stdout);
+// Transform only the given extents from the input mapping into a fresh
+// output that ftruncate() left as one big hole. crc (optional) covers the
+// whole payload as read, holes counting as zeros on both sides.
+int sparse_file(int in_fd, const char *output, const struct stat *in_st,
+                worker_pool_t *pool, const crypt_params_t *params, size_t in_skip,
+                const file_header_t *hdr, const extent_t *e, size_t n, crc_pair_t *crc) {
+    size_t size = in_st->st_size - in_skip;
+    size_t out_skip = hdr ? sizeof(*hdr) : 0;
+    size_t out_size = size + out_skip;
 
-    tcgetattr(STDIN_FILENO, &oldt);   // backup
-    newt = oldt;
-    newt.c_lflag &= ~ECHO;            // disable echo
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    int out_fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (out_fd < 0) { perror("open output"); return -1; }
+    if (ftruncate(out_fd, out_size) < 0) { perror("ftruncate"); close(out_fd); return -1; }
 
-    fgets(buf, sizeof(buf), stdin);
+    unsigned char *dst = mmap(NULL, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    unsigned char *src = mmap(NULL, in_st->st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    thread_job_t *segs = malloc((n + 1) * sizeof(*segs));
+    crc_pair_t *seg_crc = malloc((n + 1) * sizeof(*seg_crc));
+    int rc = 0;
+    if (dst == MAP_FAILED || src == MAP_FAILED) { perror("mmap"); rc = -1; }
+    else if (!segs || !seg_crc) { perror("malloc"); rc = -1; }
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt); // restore
-    printf("\n");
+    if (rc == 0) {
+        if (hdr) memcpy(dst, hdr, out_skip);
+        for (size_t i = 0; i < n; i++) {
+            thread_job_t seg = { dst + out_skip + e[i].offset, src + in_skip + e[i].offset,
+                                 0, e[i].length, e[i].offset, params, 0 };
+            segs[i] = seg;
+        }
+        pool_run_segments(pool, segs, (int)n, crc ? seg_crc : NULL);
+        if (msync(dst, out_size, MS_SYNC) < 0) { perror("msync"); rc = -1; }
+    }
+
+    // Stitch the extent CRCs together with the zero runs between them
+    for (size_t i = 0, pos = 0; rc == 0 && crc && i <= n; i++) {
+        uint64_t start = i < n ? e[i].offset : size;
+        if (start > pos) {
+            uint32_t z = crc32c_zeros(start - pos);
+            crc->in = crc32c_combine(crc->in, z, start - pos);
+            crc->out = crc32c_combine(crc->out, z, start - pos);
+        }
+        if (i == n) break;
+        crc->in = crc32c_combine(crc->in, seg_crc[i].in, e[i].length);
+        crc->out = crc32c_combine(crc->out, seg_crc[i].out, e[i].length);
+        pos = e[i].offset + e[i].length;
+    }
+
+    if (dst != MAP_FAILED) munmap(dst, out_size);
+    if (src != MAP_FAILED) munmap(src, in_st->st_size);
+    free(segs);
+    free(seg_crc);
+    close(out_fd);
+    return rc;
+}
+
+// ---------------------------- SINGLE FILE ----------------------------
+double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Seconds from a to b, both already read
+double seconds_between(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+// Per-file cipher state: chacha20 gets a fresh header on encrypt and
+// reads the input header on decrypt. Returns input bytes to skip, or -1.
+ssize_t prepare_params(crypt_params_t *p, const unsigned char *first, size_t size,
+                       file_header_t *hdr, file_header_t **out_hdr) {
+    *out_hdr = NULL;
+    if (p->cipher != CIPHER_CHACHA20) return 0;
+
+    if (p->encrypt) {
+        if (cipher_setup_encrypt(p, hdr) < 0) return -1;
+        *out_hdr = hdr;
+        return 0;
+    }
+    if (size <= sizeof(*hdr)) {
+        fprintf(stderr, "Input is not a chacha20 filecrypt file.\n");
+        return -1;
+    }
+    memcpy(hdr, first, sizeof(*hdr));
+    if (cipher_setup_decrypt(p, hdr) < 0) return -1;
+    return sizeof(*hdr);
+}
+
+// Encrypt or decrypt one file with the selected I/O mode
+int crypt_file(const char *input, const char *output, worker_pool_t *pool,
+               const crypt_params_t *base, const run_opts_t *opts, file_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    int in_stdin = strcmp(input, "-") == 0;
+    int out_stdout = strcmp(output, "-") == 0;
+
+    // Open file
+    int fd = in_stdin ? STDIN_FILENO : open(input, O_RDONLY);
+    if (fd < 0) { perror("open input"); return -1; }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return -1; }
+
+    // Pipes and other non-regular inputs have no size to map: stream them
+    int regular = S_ISREG(st.st_mode);
+    size_t size = regular ? (size_t)st.st_size : 0;
+    res->size = size;
+    if (regular && size == 0) {
+        fprintf(stderr, "Input file is empty.\n");
+        close(fd);
+        return -1;
+    }
+    if ((!regular || out_stdout) && (opts->map_out || opts->direct)) {
+        fprintf(stderr, "%s needs regular input and output files.\n",
+                opts->map_out ? "--map" : "--direct");
+        if (!in_stdin) close(fd);
+        return -1;
+    }
+
+    crypt_params_t params = *base;
+    file_header_t hdr, *out_hdr;
+    unsigned char first[sizeof(hdr)] = {0};
+    size_t avail = size;
+    if (params.cipher == CIPHER_CHACHA20 && !params.encrypt) {
+        // A pipe cannot be rewound, so its header is consumed here
+        ssize_t n = regular ? pread(fd, first, sizeof(first), 0)
+                            : read_full(fd, first, sizeof(first));
+        if (n < 0) {
+            perror("read header");
+            if (!in_stdin) close(fd);
+            return -1;
+        }
+        if (!regular) avail = (size_t)n == sizeof(first) ? sizeof(first) + 1 : (size_t)n;
+    }
+    ssize_t in_skip = prepare_params(&params, first, avail, &hdr, &out_hdr);
+    if (in_skip < 0) { if (!in_stdin) close(fd); return -1; }
+    if (!regular) in_skip = 0;
+
+    // Sparse: an encrypt with --sparse follows the input's holes, and a
+    // decrypt follows <input>.fcmap whenever there is one, since ignoring
+    // it would turn the holes into garbage
+    extent_t *extents = NULL;
+    size_t nextents = 0;
+    int sparse = 0;
+    if (regular && !params.encrypt)
+        sparse = extent_map_load(input, size - in_skip, &extents, &nextents);
+    else if (opts->sparse)
+        sparse = regular && find_extents(fd, in_skip, size - in_skip, &extents, &nextents) == 0 ? 1 : -1;
+    if (sparse != 0) {
+        struct stat out_st;
+        const char *why = NULL;
+        if (sparse < 0)
+            why = regular ? "" : "--sparse needs a regular input file.";
+        else if (out_stdout)
+            why = "Sparse files need a regular output file.";
+        else if (opts->resume)
+            why = "Sparse runs cannot be resumed; start again.";
+        else if (stat(output, &out_st) == 0 && out_st.st_dev == st.st_dev &&
+                 out_st.st_ino == st.st_ino)
+            why = "Sparse files cannot be transformed in place.";
+        if (why) {
+            if (*why) fprintf(stderr, "%s\n", why);
+            if (!in_stdin) close(fd);
+            free(extents);
+            return -1;
+        }
+    } else if (params.encrypt && !out_stdout) {
+        extent_map_drop(output);
+    }
+
+    // Chunk journal: tracked for every regular file, written only on interrupt
+    journal_t j = {0};
+    if (regular && !out_stdout && journal_init(&j, size - in_skip) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (opts->resume) {
+        if (!regular || out_stdout) {
+            fprintf(stderr, "--resume needs regular input and output files.\n");
+            if (!in_stdin) close(fd);
+            free(j.bits);
+            return -1;
+        }
+        int bad = journal_load(&j, output, &params) < 0;
+
+        // Keep the nonce the interrupted run already wrote to the output
+        if (!bad && out_hdr) {
+            int ofd = open(output, O_RDONLY);
+            if (ofd < 0) {
+                perror(output);
+                bad = 1;
+            } else if (pread(ofd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+                       memcmp(hdr.magic, HEADER_MAGIC, 4) != 0) {
+                fprintf(stderr, "%s has no chacha20 header to resume from; start again without --resume.\n",
+                        output);
+                bad = 1;
+            } else {
+                bad = cipher_setup_decrypt(&params, &hdr) < 0;
+            }
+            if (ofd >= 0) close(ofd);
+        }
+        if (!bad)
+            bad = !journal_key_matches(&j, output, &params);
+        if (bad) {
+            close(fd);
+            free(j.bits);
+            return -1;
+        }
+    }
+
+    // CRC32C rides along with the transform; a resume skips chunks, so
+    // there is no whole-file value to compute
+    crc_pair_t crc = {0, 0};
+    crc_pair_t *want_crc = opts->resume ? NULL : &crc;
+
+    struct timespec start;
+    int rc = 0;
+
+    if (sparse) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = sparse_file(fd, output, &st, pool, &params, in_skip, out_hdr, extents, nextents,
+                         want_crc);
+        res->elapsed = seconds_since(&start);
+        res->written = size - in_skip;
+        res->extents = nextents;
+        for (size_t i = 0; i < nextents; i++) res->data_bytes += extents[i].length;
+        close(fd);
+        if (rc == 0 && params.encrypt && !stop_requested)
+            rc = extent_map_save(output, extents, nextents, size - in_skip);
+        free(extents);
+        free(j.bits);
+        if (rc == 0) rc = checksum_finish(input, output, &params, want_crc, res);
+        return rc;
+    }
+
+    // Streaming truncates the output before reading the input, which
+    // would empty a file encrypted onto itself; that case goes in place
+    struct stat out_st;
+    int same_file = regular && !out_stdout && stat(output, &out_st) == 0 &&
+                    out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino;
+
+    if ((opts->stream && !opts->resume && !same_file) || !regular || out_stdout) {
+        int out_fd = out_stdout ? data_out_fd
+                                : open(output, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (out_fd < 0) { perror("open output"); if (!in_stdin) close(fd); return -1; }
+
+        res->streamed = 1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (out_hdr && write_full(out_fd, (const unsigned char *)out_hdr, sizeof(*out_hdr)) < 0) {
+            perror("write header");
+            rc = -1;
+        }
+        if (in_skip && lseek(fd, in_skip, SEEK_SET) < 0) {
+            perror("lseek");
+            rc = -1;
+        }
+        if (rc == 0)
+            rc = stream_file(fd, out_fd, opts->chunk_size, pool, &params, &res->written, want_crc);
+        res->elapsed = seconds_since(&start);
+
+        if (!in_stdin) close(fd);
+        if (close(out_fd) < 0 && rc == 0) { perror("close output"); rc = -1; }
+        if (rc == 0 && stop_requested && j.bits) {
+            journal_mark_prefix(&j, res->written);
+            journal_checkpoint(&j, output, &params);
+        }
+        free(j.bits);
+        if (rc == 0) rc = checksum_finish(input, output, &params, want_crc, res);
+        return rc;
+    }
+
+    if (opts->direct && !opts->resume) {
+        // The descriptor above stays buffered for the header; data goes
+        // through fresh O_DIRECT descriptors
+        if (same_file) {
+            fprintf(stderr, "--direct cannot work in place; use --map.\n");
+            close(fd);
+            free(j.bits);
+            return -1;
+        }
+        int in_dfd = open(input, O_RDONLY | O_DIRECT);
+        int out_dfd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0600);
+        if (in_dfd < 0 || out_dfd < 0) {
+            perror(errno == EINVAL ? "O_DIRECT not supported here" : "open");
+            if (in_dfd >= 0) close(in_dfd);
+            if (out_dfd >= 0) close(out_dfd);
+            close(fd);
+            free(j.bits);
+            return -1;
+        }
+        close(fd);
+
+        // The chacha20 header also rides in chunk 0, but if that chunk
+        // never lands a resume still needs the nonce, so put it on disk now
+        if (out_hdr) {
+            int hfd = open(output, O_WRONLY);
+            if (hfd < 0 || pwrite(hfd, out_hdr, sizeof(*out_hdr), 0) != sizeof(*out_hdr) ||
+                fdatasync(hfd) < 0) {
+                perror("write header");
+                rc = -1;
+            }
+            if (hfd >= 0) close(hfd);
+            if (rc < 0) {
+                close(in_dfd);
+                close(out_dfd);
+                free(j.bits);
+                return -1;
+            }
+        }
+
+        size_t chunk = ALIGN_UP(opts->chunk_size);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = direct_file(in_dfd, out_dfd, size - in_skip, in_skip, out_hdr, chunk, opts->depth,
+                         pool, &params, &res->written, want_crc, &res->io);
+        res->elapsed = seconds_since(&start);
+        close(in_dfd);
+        if (close(out_dfd) < 0 && rc == 0) { perror("close output"); rc = -1; }
+        if (rc == 0 && stop_requested) {
+            journal_mark_prefix(&j, res->written);
+            journal_checkpoint(&j, output, &params);
+        }
+        free(j.bits);
+        if (rc == 0) rc = checksum_finish(input, output, &params, want_crc, res);
+        return rc;
+    }
+
+    if (opts->map_out || opts->resume || (opts->stream && same_file)) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = map_file(fd, output, &st, pool, &params, in_skip, out_hdr, &j,
+                      opts->resume, &res->in_place, want_crc);
+        res->elapsed = seconds_since(&start);
+        res->written = size - in_skip;
+        close(fd);
+        if (rc == 0 && stop_requested)
+            journal_checkpoint(&j, output, &params);
+        else if (rc == 0 && opts->resume)
+            journal_remove(output);
+        free(j.bits);
+        if (rc == 0) rc = checksum_finish(input, output, &params, want_crc, res);
+        return rc;
+    }
+
+    // mmap the input file
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { perror("mmap"); close(fd); free(j.bits); return -1; }
+
+    // Output buffer: the workers transform straight from the input mapping
+    // into it, so each page is first-touched by the worker that fills it
+    // rather than by a serial memcpy here
+    size_t data_size = size - in_skip;
+    unsigned char *buffer = buffer_alloc(data_size);
+    if (!buffer) { perror("mmap"); munmap(map, size); close(fd); free(j.bits); return -1; }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    close(fd);
+
+    // Timing
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool->done = j.bits;
+    pool_run(pool, buffer, map + in_skip, data_size, 0, &params, want_crc);
+    pool->done = NULL;
+    res->elapsed = seconds_since(&start);
+    res->huge = buffer_huge_bytes(buffer);
+    res->buffered = data_size;
+
+    // Chunks skipped after a signal still hold zeroes; copy them through
+    // untransformed so the journal stays accurate
+    if (stop_requested) {
+        for (size_t c = 0; c < j.nchunks; c++) {
+            if (atomic_load(&j.bits[c / 64]) & (1ULL << (c % 64))) continue;
+            size_t off = c * POOL_GRAIN;
+            size_t n = data_size - off < POOL_GRAIN ? data_size - off : POOL_GRAIN;
+            memcpy(buffer + off, map + in_skip + off, n);
+        }
+    }
+
+    // Save output
+    int out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (out_fd < 0) {
+        perror("open output");
+        rc = -1;
+    } else {
+        if ((out_hdr && write_full(out_fd, (const unsigned char *)out_hdr, sizeof(*out_hdr)) < 0) ||
+            write_full(out_fd, buffer, data_size) < 0) {
+            perror("write");
+            rc = -1;
+        }
+        close(out_fd);
+    }
+    res->written = rc == 0 ? data_size : 0;
+
+    // Untransformed chunks were written as input copies; the journal says which
+    if (rc == 0 && stop_requested)
+        journal_checkpoint(&j, output, &params);
+    free(j.bits);
+
+    if (rc == 0) rc = checksum_finish(input, output, &params, want_crc, res);
+
+    // Cleanup
+    munmap(map, size);
+    buffer_free(buffer, data_size);
+    return rc;
+}
+
+// ---------------------------- BATCH MODE ----------------------------
+int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), k = strlen(suffix);
+    return n > k && strcmp(s + n - k, suffix) == 0;
+}
+
+int list_add(file_list_t *l, const char *in, const char *out, size_t size) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        batch_file_t *f = realloc(l->files, cap * sizeof(*f));
+        if (!f) { perror("realloc"); return -1; }
+        l->files = f;
+        l->cap = cap;
+    }
+    batch_file_t *f = &l->files[l->count];
+    f->in = strdup(in);
+    f->out = strdup(out);
+    f->size = size;
+    if (!f->in || !f->out) { perror("strdup"); return -1; }
+    l->count++;
+    return 0;
+}
+
+int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Sidecars and journals travel with their data file, so they are dropped
+// from the list when that file is in it too. One whose data file is not
+// (or a user file that merely has such a name) is reported and skipped.
+// Returns the number skipped that way, or -1 if out of memory.
+int list_drop_sidecars(file_list_t *l) {
+    static const char *const suffixes[] = { SUM_SUFFIX, MAP_SUFFIX, JOURNAL_SUFFIX };
+    char **names = malloc((l->count + 1) * sizeof(char *));
+    unsigned char *drop = calloc(l->count + 1, 1);
+    if (!names || !drop) { perror("malloc"); free(names); free(drop); return -1; }
+    for (size_t i = 0; i < l->count; i++) names[i] = l->files[i].in;
+    qsort(names, l->count, sizeof(char *), cmp_str);
+
+    int skipped = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        batch_file_t *f = &l->files[i];
+        const char *suffix = NULL;
+        for (size_t k = 0; k < sizeof(suffixes) / sizeof(suffixes[0]); k++)
+            if (has_suffix(f->in, suffixes[k])) suffix = suffixes[k];
+        if (!suffix) continue;
+        drop[i] = 1;
+
+        char data[PATH_MAX];
+        snprintf(data, sizeof(data), "%.*s", (int)(strlen(f->in) - strlen(suffix)), f->in);
+        char *key = data;
+        if (!bsearch(&key, names, l->count, sizeof(char *), cmp_str)) {
+            fprintf(stderr, "[-] Skipping %s (sidecar name)\n", f->in);
+            skipped++;
+        }
+    }
+
+    // names[] points into the list, so nothing is freed until here
+    size_t kept = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        if (drop[i]) {
+            free(l->files[i].in);
+            free(l->files[i].out);
+        } else {
+            l->files[kept++] = l->files[i];
+        }
+    }
+    l->count = kept;
+    free(names);
+    free(drop);
+    return skipped;
+}
+
+void list_free(file_list_t *l) {
+    for (size_t i = 0; i < l->count; i++) {
+        free(l->files[i].in);
+        free(l->files[i].out);
+    }
+    free(l->files);
+}
+
+// Walk dir recursively, mirroring its layout under outdir
+int collect_dir(file_list_t *l, const char *dir, const char *outdir) {
+    DIR *d = opendir(dir);
+    if (!d) { perror(dir); return -1; }
+
+    struct dirent *e;
+    char in[PATH_MAX], out[PATH_MAX];
+    int rc = 0;
+    while ((e = readdir(d)) != NULL && rc == 0) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        snprintf(in, sizeof(in), "%s/%s", dir, e->d_name);
+        snprintf(out, sizeof(out), "%s/%s", outdir, e->d_name);
+
+        struct stat st;
+        if (lstat(in, &st) < 0) { perror(in); continue; }
+        if (S_ISDIR(st.st_mode))
+            rc = collect_dir(l, in, out);
+        else if (S_ISREG(st.st_mode))
+            rc = list_add(l, in, out, st.st_size);
+        else
+            fprintf(stderr, "[-] Skipping %s (not a regular file)\n", in);
+    }
+    closedir(d);
+    return rc;
+}
+
+// mkdir -p for the directory part of path
+int make_parent_dirs(const char *path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0700) < 0 && errno != EEXIST) { perror(tmp); return -1; }
+        *p = '/';
+    }
+    return 0;
+}
+
+// Transform the queued small files with one pool job, then write them out.
+// Returns the number of files that failed.
+int flush_batch(small_batch_t *b, worker_pool_t *pool, size_t *bytes_out) {
+    int failed = 0;
+    if (b->count == 0) return 0;
+
+    crc_pair_t crcs[BATCH_FILES];
+    pool_run_segments(pool, b->segs, b->count, crcs);
+
+    for (int i = 0; i < b->count && !stop_requested; i++) {
+        const thread_job_t *seg = &b->segs[i];
+        const crypt_params_t *p = &b->params[i];
+        int has_hdr = p->cipher == CIPHER_CHACHA20 && p->encrypt;
+
+        int out_fd = open(b->files[i]->out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (out_fd < 0 ||
+            (has_hdr && write_full(out_fd, (const unsigned char *)&b->hdrs[i], sizeof(b->hdrs[i])) < 0) ||
+            write_full(out_fd, seg->data, seg->end) < 0) {
+            perror(b->files[i]->out);
+            failed++;
+        } else if (p->encrypt ? checksum_save(b->files[i]->out, p, seg->end, &crcs[i]) < 0 ||
+                                extent_map_drop(b->files[i]->out) < 0
+                              : checksum_check(b->files[i]->in, p, seg->end, &crcs[i]) < 0) {
+            failed++;
+        } else {
+            *bytes_out += seg->end;
+        }
+        if (out_fd >= 0) close(out_fd);
+    }
+    b->used = 0;
+    b->count = 0;
+    return failed;
+}
+
+// Queue one small file into the batch buffer. Returns 0 or -1.
+int queue_small_file(small_batch_t *b, const batch_file_t *f, const crypt_params_t *base) {
+    int fd = open(f->in, O_RDONLY);
+    if (fd < 0) { perror(f->in); return -1; }
+    unsigned char *dst = b->buf + b->used;
+    ssize_t n = read_full(fd, dst, f->size);
+    close(fd);
+    if (n != (ssize_t)f->size) {
+        fprintf(stderr, "%s: short read\n", f->in);
+        return -1;
+    }
+
+    crypt_params_t *p = &b->params[b->count];
+    file_header_t *out_hdr;
+    *p = *base;
+    ssize_t skip = prepare_params(p, dst, f->size, &b->hdrs[b->count], &out_hdr);
+    if (skip < 0) {
+        fprintf(stderr, "%s: skipped\n", f->in);
+        return -1;
+    }
+
+    thread_job_t *seg = &b->segs[b->count];
+    seg->data = dst + skip;
+    seg->src = dst + skip;
+    seg->start = 0;
+    seg->end = f->size - skip;
+    seg->offset = 0;
+    seg->params = p;
+    b->files[b->count] = f;
+    b->used += f->size;
+    b->count++;
+    return 0;
+}
+
+// Process every input through one pool: small files are grouped into
+// shared jobs, large files are split into ranges by crypt_file().
+int run_batch(char **inputs, int ninputs, const char *outdir, int recursive,
+              worker_pool_t *pool, const crypt_params_t *base, const run_opts_t *opts) {
+    file_list_t list = {0};
+    char out[PATH_MAX];
+
+    for (int i = 0; i < ninputs; i++) {
+        struct stat st;
+        if (stat(inputs[i], &st) < 0) { perror(inputs[i]); continue; }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!recursive) {
+                fprintf(stderr, "%s is a directory (use -r).\n", inputs[i]);
+                continue;
+            }
+            char tmp[PATH_MAX];
+            snprintf(tmp, sizeof(tmp), "%s", inputs[i]);
+            snprintf(out, sizeof(out), "%s/%s", outdir, basename(tmp));
+            if (collect_dir(&list, inputs[i], out) < 0) { list_free(&list); return -1; }
+        } else if (S_ISREG(st.st_mode)) {
+            char tmp[PATH_MAX];
+            snprintf(tmp, sizeof(tmp), "%s", inputs[i]);
+            snprintf(out, sizeof(out), "%s/%s", outdir, basename(tmp));
+            if (list_add(&list, inputs[i], out, st.st_size) < 0) { list_free(&list); return -1; }
+        } else {
+            fprintf(stderr, "[-] Skipping %s (not a regular file)\n", inputs[i]);
+        }
+    }
+
+    int skipped = list_drop_sidecars(&list);
+    if (skipped < 0) { list_free(&list); return -1; }
+
+    small_batch_t *b = calloc(1, sizeof(*b));
+    if (!b || !(b->buf = buffer_alloc(BATCH_BYTES))) {
+        perror("malloc");
+        free(b);
+        list_free(&list);
+        return -1;
+    }
+
+    size_t done = 0, small = 0, large = 0, bytes_in = 0, bytes_out = 0;
+    int failed = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < list.count && !stop_requested; i++) {
+        const batch_file_t *f = &list.files[i];
+        if (make_parent_dirs(f->out) < 0) { failed++; continue; }
+        if (f->size == 0) {
+            fprintf(stderr, "[-] Skipping %s (empty)\n", f->in);
+            skipped++;
+            continue;
+        }
+
+        // A file with an extent map must be decrypted by crypt_file()
+        char map[PATH_MAX];
+        map_path(f->in, map, sizeof(map));
+        if (f->size < SMALL_FILE_MAX && (base->encrypt || access(map, F_OK) != 0)) {
+            if (b->count == BATCH_FILES || b->used + f->size > BATCH_BYTES)
+                failed += flush_batch(b, pool, &bytes_out);
+            if (queue_small_file(b, f, base) < 0) { failed++; continue; }
+            small++;
+        } else {
+            // Large file: the pool splits it into ranges on its own
+            failed += flush_batch(b, pool, &bytes_out);
+            file_result_t res;
+            if (crypt_file(f->in, f->out, pool, base, opts, &res) < 0) {
+                fprintf(stderr, "[!] %s failed\n", f->in);
+                failed++;
+                continue;
+            }
+            bytes_out += res.written;
+            large++;
+        }
+        bytes_in += f->size;
+        done++;
+    }
+    if (!stop_requested)
+        failed += flush_batch(b, pool, &bytes_out);
+
+    double elapsed = seconds_since(&start);
+
+    printf("\n[+] Batch completed.\n");
+    printf("[+] Files: %zu processed (%zu batched small, %zu large), %d failed, %d skipped\n",
+           done, small, large, failed, skipped);
+    printf("[+] Bytes read: %zu, written: %zu\n", bytes_in, bytes_out);
+    printf("[+] Threads used: %d\n", pool->count);
+    printf("[+] Engine: %s\n", engine_name(base));
+    printf("[+] Time taken: %.4f seconds\n", elapsed);
+    if (elapsed > 0)
+        printf("[+] Throughput: %.1f MB/s, %.0f files/s\n",
+               bytes_in / elapsed / 1e6, done / elapsed);
+    pool_report(pool);
+
+    if (stop_requested)
+        printf("[!] Warning: Operation interrupted by signal; queued files were not written.\n");
+
+    buffer_free(b->buf, BATCH_BYTES);
+    free(b);
+    list_free(&list);
+    return failed ? -1 : 0;
+}
+
+// ---------------------------- BENCHMARK ----------------------------
+// Parse "1,2,8" or "64K,1M" into values; returns count
+int parse_list(const char *s, size_t *out, int max, int sizes) {
+    char tmp[256];
+    int n = 0;
+    snprintf(tmp, sizeof(tmp), "%s", s);
+    for (char *tok = strtok(tmp, ","); tok && n < max; tok = strtok(NULL, ",")) {
+        size_t v = sizes ? parse_size(tok) : strtoul(tok, NULL, 10);
+        if (v == 0) return -1;
+        out[n++] = v;
+    }
+    return n;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// min / median / p95 of n samples (sorts in place)
+void bench_stats(double *v, int n, double *min, double *med, double *p95) {
+    qsort(v, n, sizeof(double), cmp_double);
+    *min = v[0];
+    *med = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    int idx = (int)(0.95 * n + 0.999999) - 1;
+    *p95 = v[idx < 0 ? 0 : idx];
+}
+
+// Fill path with size bytes of xorshift noise
+int bench_generate(const char *path, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) { perror("open bench file"); return -1; }
+
+    size_t blk = 8UL << 20;
+    unsigned char *buf = malloc(blk);
+    if (!buf) { perror("malloc"); close(fd); return -1; }
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    int rc = 0;
+    for (size_t done = 0; done < size && rc == 0; done += blk) {
+        size_t n = size - done < blk ? size - done : blk;
+        for (size_t i = 0; i + 8 <= n; i += 8) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            memcpy(buf + i, &x, 8);
+        }
+        rc = write_full(fd, buf, n);
+    }
+    if (rc < 0) perror("write bench file");
+    free(buf);
+    close(fd);
+    return rc;
+}
 
-    return atoi(buf);
+// One pass over the file: read, transform and write each chunk in turn so
+// the three phases are timed separately (GB/s per phase in t[0..2], total in t[3])
+int bench_trial(int in_fd, int out_fd, size_t size, size_t chunk, unsigned char *buf,
+                worker_pool_t *pool, const crypt_params_t *p, double t[4]) {
+    struct timespec a, b, c, d;
+    double rd = 0, tr = 0, wr = 0;
+    size_t done = 0;    // a signal can end the trial early
+
+    if (lseek(in_fd, 0, SEEK_SET) < 0 || lseek(out_fd, 0, SEEK_SET) < 0) {
+        perror("lseek");
+        return -1;
+    }
+    for (size_t off = 0; off < size && !stop_requested; off += chunk) {
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        ssize_t n = read_full(in_fd, buf, chunk);
+        if (n <= 0) { if (n < 0) perror("read"); return -1; }
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        pool_run(pool, buf, buf, n, off, p, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &c);
+        if (write_full(out_fd, buf, n) < 0) { perror("write"); return -1; }
+        clock_gettime(CLOCK_MONOTONIC, &d);
+
+        rd += seconds_between(&a, &b);
+        tr += seconds_between(&b, &c);
+        wr += seconds_between(&c, &d);
+        done += n;
+    }
+    double gb = done / 1e9;
+    t[0] = rd > 0 ? gb / rd : 0;
+    t[1] = tr > 0 ? gb / tr : 0;
+    t[2] = wr > 0 ? gb / wr : 0;
+    t[3] = rd + tr + wr > 0 ? gb / (rd + tr + wr) : 0;
+    return 0;
 }
 
-// ---------------------------- CAESAR CIPHER (Thread Worker) ----------------------------
-void *thread_caesar(void *arg) {
-    thread_job_t *job = (thread_job_t *)arg;
-    int key = job->encrypt ? job->key : -job->key;
+// Sweep thread counts x chunk sizes with warm-up and repeated trials
+int run_bench(const char *file, size_t size, int trials, const size_t *threads, int nthreads,
+              const size_t *chunks, int nchunks, const char *csv, const crypt_params_t *p,
+              int pin) {
+    static const char *phase[4] = {"read", "transform", "write", "total"};
+    int generated = 0;
+    struct stat st;
+
+    if (stat(file, &st) < 0) {
+        printf("[+] Generating %zu-byte bench file %s\n", size, file);
+        if (bench_generate(file, size) < 0) return -1;
+        generated = 1;
+    } else {
+        size = st.st_size;
+        printf("[+] Reusing bench file %s (%zu bytes)\n", file, size);
+    }
+    if (size == 0) { fprintf(stderr, "Bench file is empty.\n"); return -1; }
+
+    char out_path[PATH_MAX];
+    snprintf(out_path, sizeof(out_path), "%s.bench.out", file);
+    int in_fd = open(file, O_RDONLY);
+    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *csv_fp = csv ? fopen(csv, "w") : NULL;
+    if (in_fd < 0 || out_fd < 0 || (csv && !csv_fp)) {
+        perror("bench open");
+        if (in_fd >= 0) close(in_fd);
+        if (out_fd >= 0) close(out_fd);
+        if (csv_fp) fclose(csv_fp);
+        return -1;
+    }
+
+    if (csv_fp) {
+        fprintf(csv_fp, "engine,file_bytes,threads,chunk_bytes,trials");
+        for (int k = 0; k < 4; k++)
+            fprintf(csv_fp, ",%s_min_gbps,%s_median_gbps,%s_p95_gbps", phase[k], phase[k], phase[k]);
+        fprintf(csv_fp, "\n");
+    }
+
+    printf("[+] Engine: %s, %d trials + 1 warm-up per configuration\n\n", engine_name(p), trials);
+    printf("%7s %9s | %-26s | %7s %9s %7s\n", "threads", "chunk",
+           "total GB/s min/median/p95", "read", "transform", "write");
+    printf("%7s %9s | %-26s | %-25s\n", "", "", "", "(median GB/s per phase)");
+
+    double (*t)[4] = malloc(trials * sizeof(*t));
+    double *v = malloc(trials * sizeof(double));
+    int rc = 0;
+
+    for (int ti = 0; ti < nthreads && rc == 0 && !stop_requested; ti++) {
+        worker_pool_t pool;
+        if (pool_create(&pool, (int)threads[ti], pin) < 0) { rc = -1; break; }
+
+        for (int ci = 0; ci < nchunks && rc == 0 && !stop_requested; ci++) {
+            unsigned char *buf = buffer_alloc(chunks[ci]);
+            if (!buf) { perror("mmap"); rc = -1; break; }
 
-    for (size_t i = job->start; i < job->end; i++) {
-        if (stop_requested) pthread_exit(NULL);
-        job->data[i] = (job->data[i] + key) % 256;
+            double warm[4];
+            rc = bench_trial(in_fd, out_fd, size, chunks[ci], buf, &pool, p, warm);
+            for (int r = 0; r < trials && rc == 0; r++)
+                rc = bench_trial(in_fd, out_fd, size, chunks[ci], buf, &pool, p, t[r]);
+            buffer_free(buf, chunks[ci]);
+            if (rc < 0 || stop_requested) break;
+
+            double s[4][3];
+            for (int k = 0; k < 4; k++) {
+                for (int r = 0; r < trials; r++) v[r] = t[r][k];
+                bench_stats(v, trials, &s[k][0], &s[k][1], &s[k][2]);
+            }
+            printf("%7zu %9zu | %7.2f / %7.2f / %7.2f | %7.2f %9.2f %7.2f\n",
+                   threads[ti], chunks[ci], s[3][0], s[3][1], s[3][2], s[0][1], s[1][1], s[2][1]);
+            if (csv_fp) {
+                fprintf(csv_fp, "%s,%zu,%zu,%zu,%d", engine_name(p), size, threads[ti], chunks[ci], trials);
+                for (int k = 0; k < 4; k++)
+                    fprintf(csv_fp, ",%.4f,%.4f,%.4f", s[k][0], s[k][1], s[k][2]);
+                fprintf(csv_fp, "\n");
+            }
+        }
+        pool_destroy(&pool);
+    }
+
+    free(t);
+    free(v);
+    close(in_fd);
+    close(out_fd);
+    unlink(out_path);
+    if (generated) unlink(file);
+    if (csv_fp) {
+        fclose(csv_fp);
+        printf("\n[+] CSV written to %s\n", csv);
     }
-    return NULL;
+    return rc;
 }
 
 // ---------------------------- HELP MENU ----------------------------
 void print_help() {
     printf("Usage: filecrypt [OPTIONS]\n");
+    printf("       filecrypt [OPTIONS] -o <dir> [-r] <file|dir>...\n");
     printf("  -e, --encrypt           Encrypt file\n");
     printf("  -d, --decrypt           Decrypt file\n");
-    printf("  -i, --input <file>      Input file\n");
-    printf("  -o, --output <file>     Output file\n");
-    printf("  -t, --threads <num>     Number of threads (default: 4)\n");
+    printf("  -i, --input <file>      Input file, - for stdin\n");
+    printf("  -o, --output <file>     Output file, - for stdout (directory in batch mode)\n");
+    printf("  -r, --recursive         Batch mode: descend into directory inputs\n");
+    printf("  -t, --threads <num>     Number of threads (default: online CPUs)\n");
+    printf("  -s, --stream            Stream the file in chunks (bounded memory)\n");
+    printf("  -c, --chunk-size <n>    Streaming chunk size, K/M/G suffix (default: 8M)\n");
+    printf("  -C, --cipher <name>     caesar (default) or chacha20\n");
+    printf("  -m, --map               Zero-copy: transform into a shared output mapping\n");
+    printf("                          (in place when input and output are the same file)\n");
+    printf("      --resume            Finish an interrupted run using its <output>.fcj journal\n");
+    printf("      --affinity          Pin each worker thread to its own CPU\n");
+    printf("      --direct            O_DIRECT I/O that bypasses the page cache (-c sets chunk)\n");
+    printf("      --queue-depth <n>   Direct I/O requests in flight (default: 8)\n");
+    printf("      --sparse            Encrypt only data extents, keep holes (<output>.fcmap)\n");
+    printf("      --key-fd <n>        Read the key/passphrase line from file descriptor n\n");
+    printf("      --key-file <file>   Read the key/passphrase from the first line of file\n");
+    printf("      --bench             Benchmark: sweep threads and chunk sizes, no key prompt\n");
+    printf("      --bench-file <file> File to benchmark (generated and removed if missing)\n");
+    printf("      --bench-size <n>    Size of a generated bench file (default: 256M)\n");
+    printf("      --trials <n>        Measured trials per configuration (default: 5)\n");
+    printf("      --sweep-threads <l> Thread counts, e.g. 1,2,4 (default: powers of 2 to CPUs)\n");
+    printf("      --sweep-chunks <l>  Chunk sizes, e.g. 256K,8M (default: 256K,1M,8M,32M)\n");
+    printf("      --csv <file>        Write bench results as CSV\n");
+    printf("      --selftest          Check all kernels, the cipher engine and CRC32C\n");
     printf("  -h, --help              Show this help\n");
 }
 
@@ -85,7 +3065,24 @@ int main(int argc, char **argv) {
     int mode = 0;          // 1=encrypt, 2=decrypt
     char *input = NULL;
     char *output = NULL;
-    int thread_count = 4;
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1) thread_count = 1;
+    int recursive = 0;
+    int cipher = CIPHER_CAESAR;
+    run_opts_t opts = { 0, 0, DEFAULT_CHUNK_SIZE, 0, 0, DIRECT_DEPTH, 0 };
+    int key_fd = -1;
+    char *key_file = NULL;
+    int bench = 0;
+    char *bench_file = "filecrypt.bench";
+    size_t bench_size = BENCH_SIZE;
+    int trials = BENCH_TRIALS;
+    char *sweep_threads = NULL;
+    char *sweep_chunks = "256K,1M,8M,32M";
+    char *csv = NULL;
+    int affinity = 0;
+
+    select_kernel();
+    select_crc32c();
 
     // Install signal handler
     signal(SIGINT, signal_handler);
@@ -96,25 +3093,114 @@ int main(int argc, char **argv) {
         {"decrypt", no_argument, 0, 'd'},
         {"input", required_argument, 0, 'i'},
         {"output", required_argument, 0, 'o'},
+        {"recursive", no_argument, 0, 'r'},
         {"threads", required_argument, 0, 't'},
+        {"stream", no_argument, 0, 's'},
+        {"chunk-size", required_argument, 0, 'c'},
+        {"map", no_argument, 0, 'm'},
+        {"cipher", required_argument, 0, 'C'},
+        {"selftest", no_argument, 0, 1000},
+        {"key-fd", required_argument, 0, 1001},
+        {"key-file", required_argument, 0, 1002},
+        {"bench", no_argument, 0, 1003},
+        {"resume", no_argument, 0, 1010},
+        {"affinity", no_argument, 0, 1011},
+        {"direct", no_argument, 0, 1012},
+        {"queue-depth", required_argument, 0, 1013},
+        {"sparse", no_argument, 0, 1014},
+        {"bench-file", required_argument, 0, 1004},
+        {"bench-size", required_argument, 0, 1005},
+        {"trials", required_argument, 0, 1006},
+        {"sweep-threads", required_argument, 0, 1007},
+        {"sweep-chunks", required_argument, 0, 1008},
+        {"csv", required_argument, 0, 1009},
         {"help", no_argument, 0, 'h'},
         {0,0,0,0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "edi:o:t:h", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "edi:o:rt:sc:mC:h", long_opts, NULL)) != -1) {
         switch (opt) {
             case 'e': mode = 1; break;
             case 'd': mode = 2; break;
             case 'i': input = optarg; break;
             case 'o': output = optarg; break;
+            case 'r': recursive = 1; break;
             case 't': thread_count = atoi(optarg); break;
+            case 's': opts.stream = 1; break;
+            case 'c': opts.chunk_size = parse_size(optarg); break;
+            case 'm': opts.map_out = 1; break;
+            case 'C':
+                if (strcmp(optarg, "caesar") == 0) cipher = CIPHER_CAESAR;
+                else if (strcmp(optarg, "chacha20") == 0) cipher = CIPHER_CHACHA20;
+                else { fprintf(stderr, "Unknown cipher '%s'.\n", optarg); return 1; }
+                break;
             case 'h': print_help(); return 0;
+            case 1000: return (kernel_selftest() + chacha_selftest() + crc32c_selftest()) ? 1 : 0;
+            case 1001: key_fd = atoi(optarg); break;
+            case 1002: key_file = optarg; break;
+            case 1003: bench = 1; break;
+            case 1010: opts.resume = 1; break;
+            case 1011: affinity = 1; break;
+            case 1012: opts.direct = 1; break;
+            case 1013: opts.depth = atoi(optarg); break;
+            case 1014: opts.sparse = 1; break;
+            case 1004: bench_file = optarg; break;
+            case 1005: bench_size = parse_size(optarg); break;
+            case 1006: trials = atoi(optarg); break;
+            case 1007: sweep_threads = optarg; break;
+            case 1008: sweep_chunks = optarg; break;
+            case 1009: csv = optarg; break;
             default: print_help(); return 1;
         }
     }
 
-    if (!mode || !input || !output) {
+    if (bench) {
+        size_t threads[BENCH_MAX_POINTS], chunks[BENCH_MAX_POINTS];
+        int nthreads = 0;
+        if (sweep_threads) {
+            nthreads = parse_list(sweep_threads, threads, BENCH_MAX_POINTS, 0);
+        } else {
+            for (int n = 1; n < thread_count && nthreads < BENCH_MAX_POINTS - 1; n *= 2)
+                threads[nthreads++] = n;
+            threads[nthreads++] = thread_count;
+        }
+        int nchunks = parse_list(sweep_chunks, chunks, BENCH_MAX_POINTS, 1);
+        if (nthreads <= 0 || nchunks <= 0 || trials < 1 || bench_size == 0) {
+            fprintf(stderr, "Invalid bench parameters.\n");
+            return 1;
+        }
+        for (int i = 0; i < nthreads; i++) {
+            if (threads[i] > MAX_THREADS) {
+                fprintf(stderr, "Invalid thread count. Must be 1-%d.\n", MAX_THREADS);
+                return 1;
+            }
+        }
+
+        // Fixed key, no prompt: only throughput matters here
+        crypt_params_t bp;
+        memset(&bp, 0, sizeof(bp));
+        bp.cipher = cipher;
+        bp.encrypt = 1;
+        bp.key = 3;
+        unsigned char key[32] = {0}, nonce[8] = {0};
+        chacha20_setup(bp.chacha, key, nonce);
+        return run_bench(bench_file, bench_size, trials, threads, nthreads,
+                         chunks, nchunks, csv, &bp, affinity) < 0 ? 1 : 0;
+    }
+
+    // Remaining arguments (and -i) are batch inputs
+    int ninputs = argc - optind;
+    int batch = recursive || ninputs > 0;
+    char **inputs = argv + optind;
+    if (batch && input) {
+        // Reuse the argv slot before the positionals for -i's file
+        inputs = argv + optind - 1;
+        inputs[0] = input;
+        ninputs++;
+    }
+
+    if (!mode || (!input && !batch) || !output) {
         print_help();
         return 1;
     }
@@ -124,89 +3210,112 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // Ask for key
-    int key = secure_get_key();
-
-    // Open file
-    int fd = open(input, O_RDONLY);
-    if (fd < 0) { perror("open input"); return 1; }
-
-    struct stat st;
-    if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return 1; }
-
-    size_t size = st.st_size;
-    if (size == 0) {
-        fprintf(stderr, "Input file is empty.\n");
-        close(fd);
+    if (opts.stream + opts.map_out + opts.direct > 1) {
+        fprintf(stderr, "--stream, --map and --direct cannot be combined.\n");
         return 1;
     }
 
-    // mmap the input file
-    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED) { perror("mmap"); close(fd); return 1; }
-
-    // Prepare output buffer
-    unsigned char *buffer = malloc(size);
-    if (!buffer) { perror("malloc"); return 1; }
-    memcpy(buffer, map, size);
-
-    close(fd);
-
-    // Prepare threads
-    pthread_t threads[MAX_THREADS];
-    thread_job_t jobs[MAX_THREADS];
-
-    // Timing
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (opts.depth < 1 || opts.depth > 256) {
+        fprintf(stderr, "Invalid queue depth. Must be 1-256.\n");
+        return 1;
+    }
 
-    size_t chunk = size / thread_count;
+    if (opts.chunk_size == 0) {
+        fprintf(stderr, "Invalid chunk size.\n");
+        return 1;
+    }
 
-    // Launch worker threads
-    for (int i = 0; i < thread_count; i++) {
-        jobs[i].data = buffer;
-        jobs[i].start = i * chunk;
-        jobs[i].end = (i == thread_count - 1) ? size : (i + 1) * chunk;
-        jobs[i].key = key;
-        jobs[i].encrypt = (mode == 1);
+    if (batch && mkdir(output, 0700) < 0 && errno != EEXIST) {
+        perror(output);
+        return 1;
+    }
 
-        pthread_create(&threads[i], NULL, thread_caesar, &jobs[i]);
+    // Pipe mode: keep the real stdout for data, send all messages to stderr
+    if (!batch && strcmp(output, "-") == 0) {
+        data_out_fd = dup(STDOUT_FILENO);
+        if (data_out_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("dup");
+            return 1;
+        }
     }
+    int stdin_busy = !batch && strcmp(input, "-") == 0;
 
-    // Wait for threads
-    for (int i = 0; i < thread_count; i++) {
-        pthread_join(threads[i], NULL);
+    // Ask for key once; chacha20 takes a passphrase and derives its key once
+    crypt_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.cipher = cipher;
+    params.encrypt = (mode == 1);
+    if (cipher == CIPHER_CHACHA20) {
+        if (get_secret("Enter passphrase: ", passphrase, sizeof(passphrase),
+                       key_fd, key_file, stdin_busy) < 0)
+            return 1;
+        if (!passphrase[0]) {
+            fprintf(stderr, "Empty passphrase.\n");
+            return 1;
+        }
+    } else {
+        char buf[32];
+        if (get_secret("Enter key (number): ", buf, sizeof(buf),
+                       key_fd, key_file, stdin_busy) < 0)
+            return 1;
+        params.key = atoi(buf);
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    // Worker threads live for the whole run
+    worker_pool_t pool;
+    if (pool_create(&pool, thread_count, affinity) < 0) return 1;
 
-    // Save output
-    int out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-    if (out_fd < 0) { perror("open output"); return 1; }
+    if (batch) {
+        int rc = run_batch(inputs, ninputs, output, recursive, &pool, &params, &opts);
+        pool_destroy(&pool);
+        memset(passphrase, 0, sizeof(passphrase));
+        return rc < 0 ? 1 : 0;
+    }
 
-    if (write(out_fd, buffer, size) != size) {
-        perror("write");
-        close(out_fd);
+    file_result_t res;
+    int rc = crypt_file(input, output, &pool, &params, &opts, &res);
+    memset(passphrase, 0, sizeof(passphrase));
+    if (rc < 0) {
+        pool_destroy(&pool);
         return 1;
     }
-    close(out_fd);
-
-    // Cleanup
-    munmap(map, size);
-    free(buffer);
 
     // Performance info
-    double elapsed =
-        (end.tv_sec - start.tv_sec) +
-        (end.tv_nsec - start.tv_nsec) / 1e9;
-
     printf("\n[+] Operation completed successfully.\n");
-    printf("[+] File size: %zu bytes\n", size);
+    if (res.size)
+        printf("[+] File size: %zu bytes\n", res.size);
+    if (res.streamed)
+        printf("[+] Bytes written: %zu\n", res.written);
     printf("[+] Threads used: %d\n", thread_count);
-    printf("[+] Time taken: %.4f seconds\n", elapsed);
+    printf("[+] Engine: %s\n", engine_name(&params));
+    if (res.streamed)
+        printf("[+] Chunk size: %zu bytes (%d buffers)\n", opts.chunk_size, STREAM_SLOTS);
+    if (opts.map_out)
+        printf("[+] Mode: %s\n", res.in_place ? "in place (shared mapping)" : "zero-copy (shared mapping)");
+    if (opts.sparse || res.extents)
+        printf("[+] Sparse: %zu data extents, %llu of %zu bytes (%.1f%% holes)\n",
+               res.extents, (unsigned long long)res.data_bytes, res.written,
+               res.written ? 100.0 - 100.0 * res.data_bytes / res.written : 0.0);
+    if (res.io)
+        printf("[+] I/O: O_DIRECT via %s, %d in flight, %zu-byte chunks\n",
+               res.io, strcmp(res.io, "io_uring") == 0 ? opts.depth : 1,
+               (size_t)ALIGN_UP(opts.chunk_size));
+    if (res.buffered)
+        printf("[+] Buffer: %zu MiB first-touched by workers, %zu MiB on huge pages\n",
+               res.buffered >> 20, res.huge >> 20);
+    printf("[+] Affinity: %s\n", affinity ? "workers pinned one per CPU" : "not pinned");
+    if (res.has_crc)
+        printf("[+] CRC32C (%s): plaintext %08x, ciphertext %08x%s\n", crc32c_name,
+               params.encrypt ? res.crc.in : res.crc.out,
+               params.encrypt ? res.crc.out : res.crc.in,
+               res.verified ? ", verified" : "");
+    printf("[+] Time taken: %.4f seconds\n", res.elapsed);
+    pool_report(&pool);
+    pool_destroy(&pool);
 
     if (stop_requested)
-        printf("[!] Warning: Operation interrupted by signal.\n");
+        printf("[!] Warning: Operation interrupted by signal; output is incomplete until %s.\n",
+               opts.sparse || res.extents ? "the run is repeated" : "resumed");
 
     return 0;
 }
@@ -0,0 +1,152 @@
+#!/bin/bash
+
+mode=$1  # kernel / roundtrip / stream / batch / error / all
+
+echo "Test Cases for filecrypt"
+gcc -Wall -O2 -o filecrypt filecrypt.c -lpthread || exit 1
+mkdir -p tests
+
+# Create minimal test files
+echo "hello filecrypt" > tests/plain.txt
+head -c 3000001 /dev/urandom > tests/random.bin
+echo -n "" > tests/empty
+
+run_test() {
+    echo ""
+    echo ">>> $1"
+    echo "Command: $2"
+    eval $2
+}
+
+# Encrypt then decrypt with key 42 and compare with the original
+roundtrip() {
+    echo 42 | ./filecrypt -e -i "$1" -o tests/enc.bin $2 > /dev/null &&
+    echo 42 | ./filecrypt -d -i tests/enc.bin -o tests/dec.bin $2 > /dev/null &&
+    cmp -s "$1" tests/dec.bin && echo "PASS" || echo "FAIL"
+}
+
+# Deliver SIGINT while filecrypt still waits for key 42, so the run stops
+# before its first chunk and leaves a journal for --resume
+interrupt_early() {
+    { sleep 0.3; echo 42; } | ./filecrypt "$@" > /dev/null 2>&1 &
+    sleep 0.1
+    kill -INT $!
+    wait $!
+}
+
+# Interrupted Caesar encrypt of random.bin whose first 256 KiB chunk is
+# done: the journal of an early interrupt gets that chunk's bit set by
+# hand, and the chunk is copied in from a complete encryption
+partial_journal() {
+    rm -f tests/part.bin* &&
+    echo 42 | ./filecrypt -e -i tests/random.bin -o tests/full.bin > /dev/null &&
+    interrupt_early -e -i tests/random.bin -o tests/part.bin &&
+    dd if=tests/full.bin of=tests/part.bin bs=256K count=1 conv=notrunc 2>/dev/null &&
+    printf '\001' | dd of=tests/part.bin.fcj bs=1 seek=32 conv=notrunc 2>/dev/null
+}
+
+# 1. KERNELS
+run_kernel_tests() {
+    echo ""
+    echo "===== KERNEL TESTS ====="
+    run_test "SIMD kernels match scalar reference" "./filecrypt --selftest"
+    run_test "Benchmark sweep with CSV" "./filecrypt --bench --bench-file tests/bench.bin --bench-size 8M --trials 2 --sweep-threads 1,2 --sweep-chunks 1M --csv tests/bench.csv && wc -l < tests/bench.csv"
+}
+
+# 2. ROUND TRIP
+run_roundtrip_tests() {
+    echo ""
+    echo "===== ROUND TRIP TESTS ====="
+    run_test "Small text file" "roundtrip tests/plain.txt"
+    run_test "Random file, 4 threads" "roundtrip tests/random.bin '-t 4'"
+    run_test "Random file, pinned workers" "roundtrip tests/random.bin '-t 3 --affinity'"
+    run_test "Random file, shared mapping" "roundtrip tests/random.bin '-m'"
+    run_test "Random file, direct I/O" "roundtrip tests/random.bin '--direct -c 64K --queue-depth 4'"
+    run_test "ChaCha20, whole file" "roundtrip tests/random.bin '-C chacha20'"
+    run_test "ChaCha20, streaming" "roundtrip tests/random.bin '-C chacha20 -s -c 100001'"
+    run_test "Pipe mode with key file" "echo 42 > tests/key.txt &&
+        cat tests/random.bin | ./filecrypt -e -C chacha20 --key-file tests/key.txt -i - -o - 2>/dev/null |
+        ./filecrypt -d -C chacha20 --key-file tests/key.txt -i - -o - 2>/dev/null |
+        cmp -s - tests/random.bin && echo PASS || echo FAIL"
+    run_test "ChaCha20, shared mapping" "roundtrip tests/random.bin '-C chacha20 -m -t 3'"
+    run_test "ChaCha20, direct I/O" "roundtrip tests/random.bin '-C chacha20 --direct -c 100K'"
+    run_test "Interrupted run resumed from a partial journal" "partial_journal &&
+        echo 42 | ./filecrypt -e --resume -i tests/random.bin -o tests/part.bin > /dev/null &&
+        cmp -s tests/full.bin tests/part.bin && [ ! -e tests/part.bin.fcj ] && echo PASS || echo FAIL"
+    run_test "ChaCha20, direct I/O interrupted before chunk 0, then resumed" "rm -f tests/enc.bin* &&
+        interrupt_early -e -C chacha20 --direct -c 64K -i tests/random.bin -o tests/enc.bin &&
+        echo 42 | ./filecrypt -e -C chacha20 --resume -i tests/random.bin -o tests/enc.bin > /dev/null &&
+        echo 42 | ./filecrypt -d -C chacha20 -i tests/enc.bin -o tests/dec.bin > /dev/null &&
+        cmp -s tests/random.bin tests/dec.bin && echo PASS || echo FAIL"
+    run_test "Sparse file keeps its holes" "truncate -s 64M tests/sparse.img &&
+        head -c 100000 tests/random.bin | dd of=tests/sparse.img bs=4096 seek=5000 conv=notrunc 2>/dev/null &&
+        echo 42 | ./filecrypt -e --sparse -i tests/sparse.img -o tests/sparse.enc > /dev/null &&
+        echo 42 | ./filecrypt -d -i tests/sparse.enc -o tests/sparse.dec > /dev/null &&
+        cmp -s tests/sparse.img tests/sparse.dec && du -k tests/sparse.enc tests/sparse.dec && echo PASS || echo FAIL"
+    run_test "In place, shared mapping" "cp tests/random.bin tests/inplace.bin &&
+        echo 42 | ./filecrypt -e -m -i tests/inplace.bin -o tests/inplace.bin > /dev/null &&
+        echo 42 | ./filecrypt -d -m -i tests/inplace.bin -o tests/inplace.bin > /dev/null &&
+        cmp -s tests/random.bin tests/inplace.bin && echo PASS || echo FAIL"
+}
+
+# 3. STREAMING
+run_stream_tests() {
+    echo ""
+    echo "===== STREAMING TESTS ====="
+    run_test "Random file, streaming" "roundtrip tests/random.bin '-s -c 64K -t 3'"
+    run_test "Streaming onto the input file keeps its data" "cp tests/random.bin tests/same.bin &&
+        echo 42 | ./filecrypt -e -s -i tests/same.bin -o tests/same.bin > /dev/null &&
+        echo 42 | ./filecrypt -d -s -i tests/same.bin -o tests/same.bin > /dev/null &&
+        cmp -s tests/random.bin tests/same.bin && echo PASS || echo FAIL"
+}
+
+# 4. BATCH MODE
+run_batch_tests() {
+    echo ""
+    echo "===== BATCH MODE TESTS ====="
+    mkdir -p tests/tree/sub
+    for i in 1 2 3 4 5; do head -c $((i * 777)) /dev/urandom > tests/tree/sub/small$i; done
+    cp tests/random.bin tests/tree/large.bin
+    run_test "Recursive directory round trip" "rm -rf tests/enc tests/dec &&
+        echo 42 | ./filecrypt -e -C chacha20 -r -o tests/enc tests/tree > /dev/null &&
+        echo 42 | ./filecrypt -d -C chacha20 -r -o tests/dec tests/enc/tree > /dev/null &&
+        diff -r tests/tree tests/dec/tree && echo PASS || echo FAIL"
+    run_test "A file with a sidecar name but no data file is reported" "echo notes > tests/notes.fcj &&
+        echo 42 | ./filecrypt -e -o tests/enc tests/plain.txt tests/notes.fcj 2>&1 > /dev/null | grep Skipping"
+    run_test "Multiple file arguments" "rm -rf tests/enc && echo 42 | ./filecrypt -e -o tests/enc tests/plain.txt tests/random.bin | grep Files"
+}
+
+# 5. ERROR HANDLING
+run_error_tests() {
+    echo ""
+    echo "===== ERROR HANDLING TESTS ====="
+    run_test "File not found" "echo 1 | ./filecrypt -e -i no_such_file -o tests/out.bin"
+    run_test "Empty file" "echo 1 | ./filecrypt -e -i tests/empty -o tests/out.bin"
+    run_test "ChaCha20 decrypt of non-chacha file" "echo 42 | ./filecrypt -d -C chacha20 -i tests/plain.txt -o tests/out.bin"
+    run_test "Invalid thread count" "./filecrypt -e -i tests/plain.txt -o tests/out.bin -t 0"
+    run_test "Decrypt with the wrong key (checksum sidecar)" "echo 42 | ./filecrypt -e -i tests/random.bin -o tests/enc.bin > /dev/null && echo 7 | ./filecrypt -d -i tests/enc.bin -o tests/dec.bin"
+    run_test "ChaCha20 decrypt with the wrong key (checksum sidecar)" "echo 42 | ./filecrypt -e -C chacha20 -i tests/random.bin -o tests/enc.bin > /dev/null && echo 7 | ./filecrypt -d -C chacha20 -i tests/enc.bin -o tests/dec.bin"
+    run_test "Resume with a different key" "partial_journal && echo 7 | ./filecrypt -e --resume -i tests/random.bin -o tests/part.bin"
+    run_test "Resume without a journal" "echo 42 | ./filecrypt -e --resume -i tests/plain.txt -o tests/out.bin"
+}
+
+# MODE CONTROL
+if [ "$mode" == "kernel" ]; then
+    run_kernel_tests
+elif [ "$mode" == "roundtrip" ]; then
+    run_roundtrip_tests
+elif [ "$mode" == "stream" ]; then
+    run_stream_tests
+elif [ "$mode" == "batch" ]; then
+    run_batch_tests
+elif [ "$mode" == "error" ]; then
+    run_error_tests
+else
+    run_kernel_tests
+    run_roundtrip_tests
+    run_stream_tests
+    run_batch_tests
+    run_error_tests
+    echo ""
+    echo "===== ALL TESTS COMPLETE ====="
+fi
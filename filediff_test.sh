@@ -1,6 +1,6 @@
 #!/bin/bash
 
-mode=$1  # text / binary / error / all
+mode=$1  # text / binary / delta / error / all
 
 echo "Test Cases for filediffadvanced"
 mkdir -p tests
@@ -8,9 +8,23 @@ mkdir -p tests
 # Create minimal test files
 echo "A1 line1" > tests/a1.txt
 echo "A1 line1 modified" > tests/a2.txt
+seq 1 20 > tests/n1.txt
+seq 1 20 | sed -e '5i inserted' -e '/^15$/d' > tests/n2.txt
 echo -n "" > tests/empty
 echo -n -e "\x01\x02\x03" > tests/bin1
 echo -n -e "\x01\x02\xFF" > tests/bin2
+head -c 1000003 /dev/urandom > tests/big1
+cp tests/big1 tests/big2
+printf 'xyz' | dd of=tests/big2 bs=1 seek=4093 conv=notrunc 2>/dev/null
+(printf 'inserted'; cat tests/big1) > tests/big3
+mkdir -p tests/tree1/sub tests/tree2/sub tests/tree1/gone
+cp tests/a1.txt tests/big1 tests/tree1/sub/
+cp tests/a1.txt tests/big2 tests/tree2/sub/
+mv tests/tree2/sub/big2 tests/tree2/sub/big1
+cp tests/n1.txt tests/tree1/
+cp tests/n2.txt tests/tree2/n1.txt
+cp tests/bin1 tests/tree1/gone/
+cp tests/bin2 tests/tree2/
 
 run_test() {
     echo ""
@@ -25,6 +39,7 @@ run_text_tests() {
     echo "===== TEXT MODE TESTS ====="
     run_test "Same text file" "./filediffadvanced text tests/a1.txt tests/a1.txt"
     run_test "Different text file" "./filediffadvanced text tests/a1.txt tests/a2.txt"
+    run_test "Inserted and deleted line" "./filediffadvanced text tests/n1.txt tests/n2.txt"
 }
 
 # 2. BINARY MODE 
@@ -33,14 +48,51 @@ run_binary_tests() {
     echo "===== BINARY MODE TESTS ====="
     run_test "Same binary file" "./filediffadvanced binary tests/bin1 tests/bin1"
     run_test "Different binary file" "./filediffadvanced binary tests/bin1 tests/bin2"
+    run_test "Large file, 3 bytes changed" "./filediffadvanced binary tests/big1 tests/big2 | grep 'Different bytes'"
+    run_test "Empty against non-empty" "./filediffadvanced binary tests/empty tests/bin1 | grep 'Different bytes'"
+    run_test "Large file, 1 thread" "./filediffadvanced -t 1 binary tests/big1 tests/big2 | grep 'Different'"
+    run_test "Large file, 4 threads" "./filediffadvanced -t 4 binary tests/big1 tests/big2 | grep 'Different'"
+    run_test "Ranges with hex excerpt" "./filediffadvanced -x binary tests/bin1 tests/big1"
+    run_test "Ranges capped at 1" "./filediffadvanced --max-ranges 1 binary tests/bin1 tests/bin2"
+    run_test "Fingerprint cache, first run" "./filediffadvanced --cache tests/fp.cache binary tests/big1 tests/big2 | grep -E 'Fingerprint|Different bytes'"
+    run_test "Fingerprint cache, second run" "./filediffadvanced --cache tests/fp.cache binary tests/big1 tests/big2 | grep -E 'Fingerprint|Different bytes'"
+    run_test "Fingerprint cache left dirty by a crash is started afresh (miss)" "printf '\\001' | dd of=tests/fp.cache bs=1 seek=44 conv=notrunc 2>/dev/null &&
+        ./filediffadvanced --cache tests/fp.cache binary tests/big1 tests/big2 | grep -E 'Fingerprint|Different bytes'"
+    run_test "Directory trees" "./filediffadvanced dir tests/tree1 tests/tree2"
+    run_test "Quick, same file (exit 0)" "./filediffadvanced quick tests/big1 tests/big1; echo \$?"
+    run_test "Quick, 3 bytes changed (exit 1)" "./filediffadvanced quick tests/big1 tests/big2; echo \$?"
+    run_test "Quick, different sizes (exit 1)" "./filediffadvanced quick tests/bin1 tests/big1; echo \$?"
 }
 
 
-# 3. ERROR HANDLING 
+# 3. DELTA MODE
+run_delta_tests() {
+    echo ""
+    echo "===== DELTA MODE TESTS ====="
+    run_test "Delta of insertion at front" "./filediffadvanced delta tests/big1 tests/big3 tests/big3.patch"
+    run_test "Patch rebuilds file2" "./filediffadvanced patch tests/big1 tests/big3.patch tests/big3.out && cmp tests/big3 tests/big3.out && echo identical"
+    run_test "Patch against wrong file1" "./filediffadvanced patch tests/big2 tests/big3.patch tests/big3.bad"
+    run_test "Delta without output file" "./filediffadvanced delta tests/big1 tests/big3"
+    run_test "Delta onto file1 or file2 is refused, inputs intact" "cp tests/big1 tests/d1 && cp tests/big3 tests/d2 &&
+        ./filediffadvanced delta tests/d1 tests/d2 tests/d1; ./filediffadvanced delta tests/d1 tests/d2 tests/d2;
+        cmp -s tests/d1 tests/big1 && cmp -s tests/d2 tests/big3 && echo intact"
+    run_test "Patch onto file1 or the patch is refused, inputs intact" "cp tests/big1 tests/d1 && cp tests/big3.patch tests/dp &&
+        ./filediffadvanced patch tests/d1 tests/dp tests/d1; ./filediffadvanced patch tests/d1 tests/dp tests/dp;
+        cmp -s tests/d1 tests/big1 && cmp -s tests/dp tests/big3.patch && echo intact"
+    run_test "Failed patch leaves no output file" "rm -f tests/short.out* && head -c -2 tests/big3.patch > tests/short.patch &&
+        ./filediffadvanced patch tests/big1 tests/short.patch tests/short.out; ls tests/short.out* 2>&1 | head -1"
+}
+
+
+# 4. ERROR HANDLING 
 run_error_tests() {
     echo ""
     echo "===== ERROR HANDLING TESTS ====="
     run_test "File not found" "./filediffadvanced text no_such_file tests/a1.txt"
+    run_test "Invalid thread count" "./filediffadvanced -t 0 binary tests/bin1 tests/bin2"
+    run_test "Quick, file not found (exit 2)" "./filediffadvanced quick no_such_file tests/bin1; echo \$?"
+    run_test "Quick, invalid thread count (exit 2)" "./filediffadvanced -t 0 quick tests/bin1 tests/bin2; echo \$?"
+    run_test "Quick, unknown option (exit 2)" "./filediffadvanced --no-such-option quick tests/bin1 tests/bin2 2>/dev/null; echo \$?"
 }
 
 # MODE CONTROL
@@ -48,11 +100,14 @@ if [ "$mode" == "text" ]; then
     run_text_tests
 elif [ "$mode" == "binary" ]; then
     run_binary_tests
+elif [ "$mode" == "delta" ]; then
+    run_delta_tests
 elif [ "$mode" == "error" ]; then
     run_error_tests
 else
     run_text_tests
     run_binary_tests
+    run_delta_tests
     run_error_tests
     echo ""
     echo "===== ALL TESTS COMPLETE ====="
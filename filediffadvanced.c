@@ -6,85 +6,2352 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <signal.h>
-#define BUF 1024
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define ARENA_BLOCK (4UL << 20)    // bytes per arena block
+#define INTERN_PREFETCH 16         // lines between prefetching a class slot and using it
+#define DIFF_CONTEXT 3             // unchanged lines around each hunk
+#define DIFF_TOO_EXPENSIVE 256     // minimum edit steps before the line diff settles for a near-minimal split
+#define DIFF_CHUNK (8UL << 20)     // bytes per binary diff work item
+#define MAX_THREADS 256
+#define MAX_RANGES 100             // ranges listed by default (--max-ranges)
+#define HEX_EXCERPT 16             // bytes of each range shown with --hex
+#define OUT_BUF (1UL << 20)        // range report output buffer
+#define DIR_BUF (64 << 10)         // getdents64 buffer
+#define CACHE_BLOCK (1UL << 20)    // bytes per cached fingerprint; DIFF_CHUNK is a multiple
+#define CACHE_ENTRIES 1024         // files the fingerprint cache can hold
+#define CACHE_SIZE 64              // default cache file size in MiB (--cache-size)
+#define DIR_SMALL_FILE (64 << 10)  // dir mode reads files up to this size instead of mapping them
+#define QUICK_BLOCK (1UL << 20)    // bytes per quick mode compare
+#define DELTA_MIN_BLOCK 1024       // delta block size bounds when not given with -b
+#define DELTA_MAX_BLOCK (128UL << 10)
+#define DELTA_SEED 0x5bd1e995      // strong block hash seed
 
 
 // TEXT DIFF: 
-   
-void text_diff(int fd1, int fd2) {
-    char buf1[BUF], buf2[BUF];
-    int line = 1;
+// A line diff in the style of diff -u. Both files are mmap'd and indexed:
+// newlines are found a 64-byte block at a time with SIMD compares, every
+// line is hashed, and identical lines share an equivalence class ID, so the
+// diff core compares integers and never touches the text. Line records and
+// the class table come from one arena that is freed in a single call. The
+// shortest edit script is found with Myers' O(ND) algorithm in its
+// linear-space form: the "middle snake" splits the problem in two and each
+// half is solved the same way. Searches that go past too_expensive edit
+// steps settle for the furthest-reaching diagonal seen so far, which keeps
+// completely different files from going quadratic at the cost of a
+// possibly non-minimal (but still correct) diff.
 
-    printf(" - TEXT DIFF -\n");
+// Bump allocator: memory is carved from large blocks and only ever freed
+// all at once
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used, size;
+    _Alignas(16) unsigned char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+} arena_t;
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    arena_block_t *b = a->head;
+    if (!b || b->size - b->used < size) {
+        size_t bsize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        b = malloc(sizeof(arena_block_t) + bsize);
+        if (!b) return NULL;
+        b->next = a->head;
+        b->used = 0;
+        b->size = bsize;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+void arena_free(arena_t *a) {
+    while (a->head) {
+        arena_block_t *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
+
+typedef struct {
+    const char *s;
+    size_t len;         // including the '\n', if any
+    uint64_t hash;
+} line_t;
+
+// LINE KERNELS:
+// Each kernel splits p[0,n) at newlines. With lines == NULL it only counts
+// them; otherwise it fills lines[] and returns the count. A trailing line
+// without '\n' is left to the caller. Blocks are turned into a 64-bit mask
+// of newline positions and the set bits are walked with ctz.
+typedef size_t (*line_fn)(const char *p, size_t n, line_t *lines);
+
+// Append the lines that end at the set bits of mask (block starts at base)
+size_t line_emit(const char *p, size_t base, uint64_t mask, size_t *start,
+                 line_t *lines, size_t count) {
+    while (mask) {
+        size_t end = base + __builtin_ctzll(mask) + 1;
+        lines[count].s = p + *start;
+        lines[count].len = end - *start;
+        count++;
+        *start = end;
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+// From offset i to the end with memchr
+size_t line_split_tail(const char *p, size_t n, size_t i, size_t start,
+                       line_t *lines, size_t count) {
+    const char *nl;
+    while (i < n && (nl = memchr(p + i, '\n', n - i)) != NULL) {
+        i = nl - p + 1;
+        if (lines) {
+            lines[count].s = p + start;
+            lines[count].len = i - start;
+        }
+        start = i;
+        count++;
+    }
+    return count;
+}
+
+size_t line_split_scalar(const char *p, size_t n, line_t *lines) {
+    return line_split_tail(p, n, 0, 0, lines, 0);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2,popcnt")))
+size_t line_split_sse2(const char *p, size_t n, line_t *lines) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0, start = 0, count = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t mask = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * k);
+        }
+        if (!lines) count += __builtin_popcountll(mask);
+        else count = line_emit(p, i, mask, &start, lines, count);
+    }
+    return line_split_tail(p, n, i, start, lines, count);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t line_split_avx2(const char *p, size_t n, line_t *lines) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0, start = 0, count = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+                      | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+        if (!lines) count += __builtin_popcountll(mask);
+        else count = line_emit(p, i, mask, &start, lines, count);
+    }
+    return line_split_tail(p, n, i, start, lines, count);
+}
+#endif
+
+typedef struct {
+    const char *name;
+    line_fn fn;
+} line_kernel_t;
+
+line_kernel_t select_line_kernel(void) {
+    line_kernel_t k = {"scalar", line_split_scalar};
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        k.name = "avx2";
+        k.fn = line_split_avx2;
+    } else if (__builtin_cpu_supports("popcnt")) {
+        k.name = "sse2";
+        k.fn = line_split_sse2;
+    }
+#endif
+    return k;
+}
+
+// 64-bit hash, 8 bytes per step; never reads past p + len. Used for lines
+// and, with a different seed, for delta blocks and whole files.
+uint64_t hash64(const void *p, size_t len, uint64_t seed) {
+    const unsigned char *s = p;
+    uint64_t h = seed ^ 0x9e3779b97f4a7c15ULL ^ len, w;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, s + i, len - i);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+typedef struct {
+    char *data;         // whole file
+    size_t size;
+    int mapped;         // data is an mmap, not a malloc
+    line_t *lines;      // from the arena
+    long *ids;          // equivalence class of each line
+    long count;
+} text_file_t;
+
+// Equivalence classes: one per distinct line, found through an open
+// addressing table on the line hash. The hash is kept in the slot so a
+// probe only follows the class to its text when the hashes match.
+// The table is far bigger than the cache, so the caller prefetches the
+// slot of a line INTERN_PREFETCH lines ahead of interning it.
+typedef struct {
+    uint64_t hash;
+    long cls;           // class + 1, 0 = empty slot
+} class_slot_t;
+
+typedef struct {
+    const line_t **rep; // first line seen of each class
+    long count;
+    class_slot_t *slots;
+    size_t mask;
+} class_table_t;
+
+long class_intern(class_table_t *t, const line_t *l) {
+    uint64_t h = l->hash;
+    for (size_t i = h & t->mask;; i = (i + 1) & t->mask) {
+        class_slot_t *slot = &t->slots[i];
+        if (slot->cls == 0) {
+            t->rep[t->count] = l;
+            slot->hash = h;
+            slot->cls = ++t->count;
+            return t->count - 1;
+        }
+        if (slot->hash == h) {
+            const line_t *r = t->rep[slot->cls - 1];
+            if (r->len == l->len && memcmp(r->s, l->s, l->len) == 0)
+                return slot->cls - 1;
+        }
+    }
+}
+
+void class_intern_all(class_table_t *t, text_file_t *f) {
+    for (long i = 0; i < f->count; i++) {
+        if (i + INTERN_PREFETCH < f->count)
+            __builtin_prefetch(&t->slots[f->lines[i + INTERN_PREFETCH].hash & t->mask], 1);
+        f->ids[i] = class_intern(t, &f->lines[i]);
+    }
+}
+
+// Map fd (or read it, if it cannot be mapped) and split it into lines; 0 on success
+int text_load(int fd, text_file_t *t, line_fn split, arena_t *arena) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat"); //Error Handling for fstat
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        t->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (t->data != MAP_FAILED) {
+            t->size = st.st_size;
+            t->mapped = 1;
+            madvise(t->data, t->size, MADV_WILLNEED);
+        } else {
+            t->data = NULL;
+        }
+    }
+
+    if (!t->mapped) {
+        size_t cap = 1 << 16;
+        t->data = malloc(cap);
+        if (!t->data) return -1;
+        for (;;) {
+            if (t->size == cap) {
+                char *p = realloc(t->data, cap * 2);
+                if (!p) return -1;
+                t->data = p;
+                cap *= 2;
+            }
+            ssize_t n = read(fd, t->data + t->size, cap - t->size);
+            if (n < 0) {
+                perror("read"); //Error Handling for read
+                return -1;
+            }
+            if (n == 0) break;
+            t->size += n;
+        }
+    }
+
+    // Count first, so the records are one exact arena allocation
+    int partial = t->size > 0 && t->data[t->size - 1] != '\n';
+    t->count = split(t->data, t->size, NULL) + partial;
+    t->lines = arena_alloc(arena, (t->count + 1) * sizeof(line_t));
+    t->ids = arena_alloc(arena, (t->count + 1) * sizeof(long));
+    if (!t->lines || !t->ids) return -1;
+
+    long n = split(t->data, t->size, t->lines);
+    if (partial) {
+        size_t start = n ? (size_t)(t->lines[n - 1].s + t->lines[n - 1].len - t->data) : 0;
+        t->lines[n].s = t->data + start;
+        t->lines[n].len = t->size - start;
+    }
+    for (long i = 0; i < t->count; i++)
+        t->lines[i].hash = hash64(t->lines[i].s, t->lines[i].len, 0);
+    return 0;
+}
+
+void text_free(text_file_t *t) {
+    if (t->mapped) munmap(t->data, t->size);
+    else free(t->data);
+}
+
+typedef struct {
+    const long *x, *y;      // equivalence class IDs
+    char *xchg, *ychg;      // 1 = line deleted from x / inserted into y
+    long *fd, *bd;          // furthest x per diagonal, forward and backward
+    long too_expensive;
+} myers_t;
 
-    // Convert fd to FILE* for fgets 
-    FILE *f1 = fdopen(fd1, "r");
-    FILE *f2 = fdopen(fd2, "r");
+typedef struct {
+    long xmid, ymid;
+    int lo_minimal, hi_minimal;
+} myers_split_t;
 
-    if (!f1 || !f2) {    
-        fprintf(stderr, "fdopen error: cannot convert file descriptor.\n");  //Error Handling for fopen
+// Find the midpoint of the shortest edit script for x[xoff,xlim) against
+// y[yoff,ylim), searching from both corners at once.
+void myers_split(myers_t *m, long xoff, long xlim, long yoff, long ylim,
+                 int minimal, myers_split_t *part) {
+    long *fd = m->fd, *bd = m->bd;
+    const long *x = m->x, *y = m->y;
+    long dmin = xoff - ylim, dmax = xlim - yoff;
+    long fmid = xoff - yoff, bmid = xlim - ylim;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    int odd = (fmid - bmid) & 1;
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+
+    for (long c = 1;; c++) {
+        long d;
+
+        // Forward: one more edit step on each active diagonal
+        if (fmin > dmin) fd[--fmin - 1] = -1; else fmin++;
+        if (fmax < dmax) fd[++fmax + 1] = -1; else fmax--;
+        for (d = fmax; d >= fmin; d -= 2) {
+            long lo = fd[d - 1], hi = fd[d + 1];
+            long i = lo < hi ? hi : lo + 1, j;
+            for (j = i - d; i < xlim && j < ylim && x[i] == y[j]; i++, j++)
+                ;
+            fd[d] = i;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= i) {
+                *part = (myers_split_t){ i, j, 1, 1 };
+                return;
+            }
+        }
+
+        // Backward, from the bottom-right corner
+        if (bmin > dmin) bd[--bmin - 1] = LONG_MAX; else bmin++;
+        if (bmax < dmax) bd[++bmax + 1] = LONG_MAX; else bmax--;
+        for (d = bmax; d >= bmin; d -= 2) {
+            long lo = bd[d - 1], hi = bd[d + 1];
+            long i = lo < hi ? lo : hi - 1, j;
+            for (j = i - d; xoff < i && yoff < j && x[i - 1] == y[j - 1]; i--, j--)
+                ;
+            bd[d] = i;
+            if (!odd && fmin <= d && d <= fmax && i <= fd[d]) {
+                *part = (myers_split_t){ i, j, 1, 1 };
+                return;
+            }
+        }
+
+        if (minimal || c < m->too_expensive) continue;
+
+        // Too expensive: split at whichever search got furthest
+        long fbest = -1, fxbest = 0, bbest = LONG_MAX, bxbest = 0;
+        for (d = fmax; d >= fmin; d -= 2) {
+            long i = fd[d] < xlim ? fd[d] : xlim, j = i - d;
+            if (j > ylim) { i = ylim + d; j = ylim; }
+            if (i + j > fbest) { fbest = i + j; fxbest = i; }
+        }
+        for (d = bmax; d >= bmin; d -= 2) {
+            long i = bd[d] > xoff ? bd[d] : xoff, j = i - d;
+            if (j < yoff) { i = yoff + d; j = yoff; }
+            if (i + j < bbest) { bbest = i + j; bxbest = i; }
+        }
+        if ((xlim + ylim) - bbest < fbest - (xoff + yoff))
+            *part = (myers_split_t){ fxbest, fbest - fxbest, 1, 0 };
+        else
+            *part = (myers_split_t){ bxbest, bbest - bxbest, 0, 1 };
         return;
     }
+}
+
+// Mark the lines of x[xoff,xlim) and y[yoff,ylim) that are not in their LCS.
+// The smaller half of each split recurses and the larger one loops, so the
+// stack stays logarithmic in the input size.
+void myers_compare(myers_t *m, long xoff, long xlim, long yoff, long ylim, int minimal) {
+    for (;;) {
+        while (xoff < xlim && yoff < ylim && m->x[xoff] == m->y[yoff]) {
+            xoff++;
+            yoff++;
+        }
+        while (xoff < xlim && yoff < ylim && m->x[xlim - 1] == m->y[ylim - 1]) {
+            xlim--;
+            ylim--;
+        }
+        if (xoff == xlim) {
+            while (yoff < ylim) m->ychg[yoff++] = 1;
+            return;
+        }
+        if (yoff == ylim) {
+            while (xoff < xlim) m->xchg[xoff++] = 1;
+            return;
+        }
+
+        myers_split_t part;
+        myers_split(m, xoff, xlim, yoff, ylim, minimal, &part);
+        if ((part.xmid - xoff) + (part.ymid - yoff) < (xlim - part.xmid) + (ylim - part.ymid)) {
+            myers_compare(m, xoff, part.xmid, yoff, part.ymid, part.lo_minimal);
+            xoff = part.xmid;
+            yoff = part.ymid;
+            minimal = part.hi_minimal;
+        } else {
+            myers_compare(m, part.xmid, xlim, part.ymid, ylim, part.hi_minimal);
+            xlim = part.xmid;
+            ylim = part.ymid;
+            minimal = part.lo_minimal;
+        }
+    }
+}
+
+void print_line(char tag, const line_t *l) {
+    putchar(tag);
+    fwrite(l->s, 1, l->len, stdout);
+    if (l->len == 0 || l->s[l->len - 1] != '\n')
+        printf("\n\\ No newline at end of file\n");
+}
 
-    while (1) {
-        char *l1 = fgets(buf1, BUF, f1);
-        char *l2 = fgets(buf2, BUF, f2);
+// "start,count" for a hunk header; an empty side names the line before it
+void print_hunk_range(long start, long count) {
+    if (count == 1) printf("%ld", start + 1);
+    else printf("%ld,%ld", count ? start + 1 : start, count);
+}
 
-        if (!l1 && !l2) break;  // both ended
+// Print the marked lines as unified hunks with DIFF_CONTEXT lines around them
+void print_unified(const text_file_t *a, const text_file_t *b, const char *xchg, const char *ychg) {
+    long i = 0, j = 0;
 
-        // If one line is NULL or content mismatch
-        if (!l1 || !l2 || strcmp(buf1, buf2) != 0) {
-            printf("Line %d different\n", line);
+    while (i < a->count || j < b->count) {
+        // Skip to the next change
+        while (i < a->count && j < b->count && !xchg[i] && !ychg[j]) {
+            i++;
+            j++;
         }
+        if (i == a->count && j == b->count) break;
+
+        // Extend the hunk while the next change is within 2 * DIFF_CONTEXT
+        long hi = i, hj = j;
+        long ei = i, ej = j;
+        for (;;) {
+            while (ei < a->count && xchg[ei]) ei++;
+            while (ej < b->count && ychg[ej]) ej++;
+            long k = 0;
+            while (ei + k < a->count && ej + k < b->count && !xchg[ei + k] && !ychg[ej + k]
+                   && k <= 2 * DIFF_CONTEXT)
+                k++;
+            if (k > 2 * DIFF_CONTEXT || (ei + k == a->count && ej + k == b->count)) break;
+            ei += k;
+            ej += k;
+        }
+
+        long pre = hi < DIFF_CONTEXT ? hi : DIFF_CONTEXT;
+        long post = a->count - ei < DIFF_CONTEXT ? a->count - ei : DIFF_CONTEXT;
+        long si = hi - pre, sj = hj - pre;
 
-        line++;
+        printf("@@ -");
+        print_hunk_range(si, ei + post - si);
+        printf(" +");
+        print_hunk_range(sj, ej + post - sj);
+        printf(" @@\n");
+
+        for (i = si, j = sj; i < ei + post || j < ej + post; ) {
+            if (i < ei && xchg[i]) {
+                while (i < a->count && xchg[i]) print_line('-', &a->lines[i++]);
+                while (j < b->count && ychg[j]) print_line('+', &b->lines[j++]);
+            } else if (j < ej && ychg[j]) {
+                while (j < b->count && ychg[j]) print_line('+', &b->lines[j++]);
+            } else {
+                print_line(' ', &a->lines[i++]);
+                j++;
+            }
+        }
+    }
+}
+
+// Returns the number of changed lines, or -1 on error
+long text_diff(int fd1, int fd2, const char *name1, const char *name2) {
+    text_file_t a = {0}, b = {0};
+    arena_t arena = {0};
+    line_kernel_t kernel = select_line_kernel();
+    long changed = -1;
+
+    printf(" - TEXT DIFF -\n");
+
+    if (text_load(fd1, &a, kernel.fn, &arena) < 0 || text_load(fd2, &b, kernel.fn, &arena) < 0) {
+        fprintf(stderr, "Cannot load files for text diff.\n");
+        text_free(&a);
+        text_free(&b);
+        arena_free(&arena);
+        return -1;
+    }
+
+    // Intern every line; the table is kept at most half full
+    class_table_t classes = {0};
+    size_t nslots = 16;
+    while (nslots < 2 * (size_t)(a.count + b.count)) nslots *= 2;
+    classes.mask = nslots - 1;
+    classes.slots = arena_alloc(&arena, nslots * sizeof(class_slot_t));
+    classes.rep = arena_alloc(&arena, (a.count + b.count + 1) * sizeof(const line_t *));
+
+    // Diagonals run from -b.count - 1 to a.count + 1
+    long diags = a.count + b.count + 3;
+    myers_t m = { a.ids, b.ids, calloc(a.count + 1, 1), calloc(b.count + 1, 1),
+                  malloc(diags * sizeof(long)), malloc(diags * sizeof(long)), 1 };
+    for (long d = diags; d != 0; d >>= 2)     // about sqrt(diags)
+        m.too_expensive <<= 1;
+    if (m.too_expensive < DIFF_TOO_EXPENSIVE) m.too_expensive = DIFF_TOO_EXPENSIVE;
+
+    if (classes.slots && classes.rep && m.xchg && m.ychg && m.fd && m.bd) {
+        memset(classes.slots, 0, nslots * sizeof(class_slot_t));
+        class_intern_all(&classes, &a);
+        class_intern_all(&classes, &b);
+
+        m.fd += b.count + 1;
+        m.bd += b.count + 1;
+        myers_compare(&m, 0, a.count, 0, b.count, 0);
+        m.fd -= b.count + 1;
+        m.bd -= b.count + 1;
+
+        long del = 0, ins = 0;
+        for (long i = 0; i < a.count; i++) del += m.xchg[i];
+        for (long j = 0; j < b.count; j++) ins += m.ychg[j];
+        if (del || ins) {
+            printf("--- %s\n+++ %s\n", name1, name2);
+            print_unified(&a, &b, m.xchg, m.ychg);
+        }
+        printf("Line kernel: %s\n", kernel.name);
+        printf("Lines: %ld and %ld, %ld distinct\n", a.count, b.count, classes.count);
+        printf("Lines: %ld deleted, %ld inserted\n", del, ins);
+        changed = del + ins;
+    } else {
+        fprintf(stderr, "Out of memory for text diff.\n");
     }
 
+    free(m.xchg);
+    free(m.ychg);
+    free(m.fd);
+    free(m.bd);
+    text_free(&a);
+    text_free(&b);
+    arena_free(&arena);
+
     // Reset file offset for binary diff
     lseek(fd1, 0, SEEK_SET);
     lseek(fd2, 0, SEEK_SET);
+    return changed;
+}
+
+// DIFF RANGES:
+// Runs of differing bytes, [offset, offset + length), in file order. Only
+// the first `limit` ranges are stored (--max-ranges); past that they are
+// only counted, so a pathological input costs neither memory nor time.
+typedef struct {
+    unsigned long long offset;
+    unsigned long long length;
+} diff_range_t;
+
+typedef struct {
+    diff_range_t *v;
+    size_t count;           // stored
+    size_t cap;
+    size_t limit;           // most ranges to store
+    size_t total;           // all ranges, stored or not
+    unsigned long long first_offset;
+    diff_range_t last;      // valid when total > 0
+    int failed;             // out of memory: list is incomplete
+} range_list_t;
+
+// Append [offset, offset + length), merging with the last range if they touch
+void range_add(range_list_t *r, unsigned long long offset, unsigned long long length) {
+    if (r->total && r->last.offset + r->last.length == offset) {
+        r->last.length += length;
+        if (r->count == r->total) r->v[r->count - 1].length += length;
+        return;
+    }
+    if (r->total++ == 0) r->first_offset = offset;
+    r->last.offset = offset;
+    r->last.length = length;
+    if (r->count >= r->limit || r->failed) return;
+    if (r->count == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 64;
+        diff_range_t *v = realloc(r->v, cap * sizeof(*v));
+        if (!v) { r->failed = 1; return; }
+        r->v = v;
+        r->cap = cap;
+    }
+    r->v[r->count++] = r->last;
+}
+
+// Append all of src, which starts at or after the end of r
+void range_append(range_list_t *r, const range_list_t *src) {
+    r->failed |= src->failed;
+    if (src->total == 0) return;
+
+    if (src->count == 0) {
+        // Nothing stored (a limit of 0): only the count and last range matter
+        int join = r->total && r->last.offset + r->last.length == src->first_offset;
+        if (!r->total) r->first_offset = src->first_offset;
+        if (join && src->total == 1) r->last.length += src->last.length;
+        else r->last = src->last;
+        r->total += src->total - join;
+        return;
+    }
+
+    for (size_t i = 0; i < src->count; i++)
+        range_add(r, src->v[i].offset, src->v[i].length);
+    if (src->total > src->count) {
+        // The ones src only counted cannot touch anything in r
+        r->total += src->total - src->count;
+        r->last = src->last;
+    }
+}
+
+// Record the runs of set bits of a block mask (bit i = byte base + i differs)
+void range_add_mask(range_list_t *r, unsigned long long base, uint64_t mask) {
+    while (mask) {
+        int start = __builtin_ctzll(mask);
+        uint64_t rest = ~(mask >> start);
+        int len = rest ? __builtin_ctzll(rest) : 64 - start;
+        range_add(r, base + start, len);
+        mask = len + start >= 64 ? 0 : mask & (~0ULL << (start + len));
+    }
+}
+
+// DIFF KERNELS:
+// Each kernel returns how many of the n byte pairs differ and, if r is
+// set, records where (base is the file offset of a[0]). Vectors are
+// compared for equality, the result is packed into a bit mask with
+// movemask and the zero bits are counted with popcount. Equal blocks,
+// the common case, cost no more than the compare.
+typedef size_t (*diff_fn)(const unsigned char *a, const unsigned char *b, size_t n,
+                          unsigned long long base, range_list_t *r);
+
+size_t diff_scalar(const unsigned char *a, const unsigned char *b, size_t n,
+                   unsigned long long base, range_list_t *r) {
+    size_t diff = 0;
+    for (size_t i = 0; i < n; i += 64) {
+        uint64_t mask = 0;
+        size_t k = n - i < 64 ? n - i : 64;
+        for (size_t j = 0; j < k; j++)
+            mask |= (uint64_t)(a[i + j] != b[i + j]) << j;
+        diff += __builtin_popcountll(mask);
+        if (mask && r) range_add_mask(r, base + i, mask);
+    }
+    return diff;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2,popcnt")))
+size_t diff_sse2(const unsigned char *a, const unsigned char *b, size_t n,
+                 unsigned long long base, range_list_t *r) {
+    size_t diff = 0, i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t eq = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(a + i + 16 * k));
+            __m128i y = _mm_loadu_si128((const __m128i *)(b + i + 16 * k));
+            eq |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) << (16 * k);
+        }
+        if (~eq) {
+            diff += __builtin_popcountll(~eq);
+            if (r) range_add_mask(r, base + i, ~eq);
+        }
+    }
+    return diff + diff_scalar(a + i, b + i, n - i, base + i, r);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t diff_avx2(const unsigned char *a, const unsigned char *b, size_t n,
+                 unsigned long long base, range_list_t *r) {
+    size_t diff = 0, i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y0 = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(a + i + 32));
+        __m256i y1 = _mm256_loadu_si256((const __m256i *)(b + i + 32));
+        uint64_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, y0)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, y1)) << 32;
+        if (~eq) {
+            diff += __builtin_popcountll(~eq);
+            if (r) range_add_mask(r, base + i, ~eq);
+        }
+    }
+    return diff + diff_scalar(a + i, b + i, n - i, base + i, r);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+size_t diff_avx512(const unsigned char *a, const unsigned char *b, size_t n,
+                   unsigned long long base, range_list_t *r) {
+    size_t diff = 0, i = 0;
+    for (; i < n; i += 64) {
+        __mmask64 m = n - i >= 64 ? (__mmask64)-1 : (__mmask64)-1 >> (64 - (n - i));
+        __m512i x = _mm512_maskz_loadu_epi8(m, a + i);
+        __m512i y = _mm512_maskz_loadu_epi8(m, b + i);
+        uint64_t ne = _mm512_cmpneq_epi8_mask(x, y);
+        if (ne) {
+            diff += __builtin_popcountll(ne);
+            if (r) range_add_mask(r, base + i, ne);
+        }
+    }
+    return diff;
+}
+#endif
+
+typedef struct {
+    const char *name;
+    diff_fn fn;
+} diff_kernel_t;
+
+// Pick the widest kernel the CPU supports
+diff_kernel_t select_diff_kernel(void) {
+    diff_kernel_t k = {"scalar", diff_scalar};
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")) {
+        k.name = "avx512"; k.fn = diff_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        k.name = "avx2"; k.fn = diff_avx2;
+    } else if (__builtin_cpu_supports("popcnt")) {
+        k.name = "sse2"; k.fn = diff_sse2;
+    }
+#endif
+    return k;
+}
+
+// FINGERPRINT CACHE: 
+// With --cache, binary mode keeps a 128-bit BLAKE2b of every CACHE_BLOCK of
+// each file it reads, keyed by (dev, inode, size, mtime). When both files
+// have fingerprints, only blocks whose hashes differ are compared, so a
+// baseline that was fingerprinted before is read only where the candidate
+// changed. A file without fingerprints is hashed in full (on -t threads)
+// and added.
+//
+// The cache is one fixed-size file, mapped shared and locked with flock()
+// while in use:
+//   cache_header_t
+//   cache_entry_t[max_entries]
+//   data area: each entry's fingerprints, packed
+// When an entry does not fit, least recently used entries are evicted and
+// the data area is compacted. Those rewrites happen in place, so they are
+// bracketed by a dirty flag that reaches the disk before the first write;
+// a process killed halfway leaves it set, and the next open starts the
+// cache afresh rather than trust a torn entry.
+
+#define CACHE_MAGIC "FDCACHE2"
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t max_entries;
+    uint64_t file_size;     // the whole cache file
+    uint64_t data_used;     // bytes of the data area in use
+    uint64_t clock;         // bumped on every use, for LRU
+    uint32_t nentries;
+    uint32_t dirty;         // set while the table or data area is rewritten
+} cache_header_t;
+
+typedef struct {
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t last_used;
+    uint64_t offset;        // into the data area
+    uint64_t nblocks;
+} cache_entry_t;
+
+typedef struct {
+    uint64_t h[2];
+} fingerprint_t;
+
+typedef struct {
+    int fd;
+    unsigned char *map;
+    size_t size;
+    cache_header_t *hdr;
+    cache_entry_t *entries;
+    unsigned char *data;
+    size_t data_cap;
+} fp_cache_t;
+
+// BLAKE2b (RFC 7693) with a 16-byte digest. Blocks are skipped on a
+// fingerprint match alone, so the hash has to be collision resistant:
+// two different blocks (crafted or not) must never share a fingerprint.
+static const uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+#define ROTR64(x, n) ((x) >> (n) | (x) << (64 - (n)))
+#define B2B_G(a, b, c, d, x, y)                                 \
+    do {                                                        \
+        v[a] += v[b] + (x); v[d] = ROTR64(v[d] ^ v[a], 32);     \
+        v[c] += v[d];       v[b] = ROTR64(v[b] ^ v[c], 24);     \
+        v[a] += v[b] + (y); v[d] = ROTR64(v[d] ^ v[a], 16);     \
+        v[c] += v[d];       v[b] = ROTR64(v[b] ^ v[c], 63);     \
+    } while (0)
+
+static void blake2b_compress(uint64_t h[8], const unsigned char *block, uint64_t counter, int last) {
+    uint64_t m[16], v[16];
+    memcpy(m, block, 128);      // little-endian words, as on every target we build for
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = blake2b_iv[i];
+    }
+    v[12] ^= counter;
+    if (last) v[14] = ~v[14];
+    for (int r = 0; r < 12; r++) {
+        const uint8_t *s = blake2b_sigma[r];
+        B2B_G(0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        B2B_G(1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        B2B_G(2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        B2B_G(3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        B2B_G(0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        B2B_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        B2B_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+        B2B_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) h[i] ^= v[i] ^ v[i + 8];
+}
+
+fingerprint_t hash128(const unsigned char *p, size_t len) {
+    uint64_t h[8];
+    memcpy(h, blake2b_iv, sizeof(h));
+    h[0] ^= 0x01010000ULL | sizeof(fingerprint_t);     // no key, 16-byte digest
+
+    size_t off = 0;
+    while (len - off > 128) {
+        blake2b_compress(h, p + off, off + 128, 0);
+        off += 128;
+    }
+    unsigned char last[128] = {0};
+    memcpy(last, p + off, len - off);
+    blake2b_compress(h, last, len, 1);
+
+    fingerprint_t f = { { h[0], h[1] } };
+    return f;
+}
+
+// Open (or create, or reset if its layout differs) the cache; 0 on success
+int cache_open(fp_cache_t *c, const char *path, size_t size) {
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    size_t table = sizeof(cache_header_t) + CACHE_ENTRIES * sizeof(cache_entry_t);
+    if (size < table + 4096) {
+        fprintf(stderr, "Cache size too small.\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("open cache"); //Error Handling for open
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) < 0) {
+        perror("flock"); //Error Handling for flock
+        close(fd);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != size && ftruncate(fd, size) < 0)) {
+        perror("cache size"); //Error Handling for ftruncate
+        close(fd);
+        return -1;
+    }
+    unsigned char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap cache"); //Error Handling for mmap
+        close(fd);
+        return -1;
+    }
+    c->fd = fd;
+    c->map = map;
+    c->size = size;
+    c->hdr = (cache_header_t *)c->map;
+    c->entries = (cache_entry_t *)(c->map + sizeof(cache_header_t));
+    c->data = c->map + table;
+    c->data_cap = size - table;
+
+    if (memcmp(c->hdr->magic, CACHE_MAGIC, 8) != 0 || c->hdr->block_size != CACHE_BLOCK
+        || c->hdr->max_entries != CACHE_ENTRIES || c->hdr->file_size != size
+        || c->hdr->nentries > CACHE_ENTRIES || c->hdr->data_used > c->data_cap
+        || c->hdr->dirty) {
+        memset(c->hdr, 0, sizeof(*c->hdr));
+        memcpy(c->hdr->magic, CACHE_MAGIC, 8);
+        c->hdr->block_size = CACHE_BLOCK;
+        c->hdr->max_entries = CACHE_ENTRIES;
+        c->hdr->file_size = size;
+    }
+    return 0;
+}
+
+void cache_close(fp_cache_t *c) {
+    if (c->map) munmap(c->map, c->size);
+    if (c->fd >= 0) close(c->fd);   // also drops the lock
+}
+
+int cache_key_match(const cache_entry_t *e, const struct stat *st) {
+    return e->dev == (uint64_t)st->st_dev && e->ino == (uint64_t)st->st_ino
+        && e->size == (uint64_t)st->st_size && e->mtime_sec == st->st_mtim.tv_sec
+        && e->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+// Copy of the fingerprints of the file, or NULL if not cached
+fingerprint_t *cache_lookup(fp_cache_t *c, const struct stat *st, size_t nblocks) {
+    for (uint32_t i = 0; i < c->hdr->nentries; i++) {
+        cache_entry_t *e = &c->entries[i];
+        if (!cache_key_match(e, st) || e->nblocks != nblocks
+            || e->offset + nblocks * sizeof(fingerprint_t) > c->data_cap) continue;
+        fingerprint_t *fp = malloc(nblocks * sizeof(fingerprint_t));
+        if (fp) memcpy(fp, c->data + e->offset, nblocks * sizeof(fingerprint_t));
+        e->last_used = ++c->hdr->clock;
+        return fp;
+    }
+    return NULL;
+}
+
+void cache_remove(fp_cache_t *c, uint32_t i) {
+    c->entries[i] = c->entries[--c->hdr->nentries];
+}
+
+int cache_entry_offset_cmp(const void *a, const void *b) {
+    uint64_t x = ((const cache_entry_t *)a)->offset, y = ((const cache_entry_t *)b)->offset;
+    return x < y ? -1 : x > y;
+}
+
+// Slide the fingerprints of the remaining entries down over the gaps
+void cache_compact(fp_cache_t *c) {
+    qsort(c->entries, c->hdr->nentries, sizeof(cache_entry_t), cache_entry_offset_cmp);
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < c->hdr->nentries; i++) {
+        cache_entry_t *e = &c->entries[i];
+        size_t bytes = e->nblocks * sizeof(fingerprint_t);
+        if (e->offset != used) memmove(c->data + used, c->data + e->offset, bytes);
+        e->offset = used;
+        used += bytes;
+    }
+    c->hdr->data_used = used;
+}
+
+// Mark the cache as being rewritten; on disk before anything else changes
+int cache_begin(fp_cache_t *c) {
+    c->hdr->dirty = 1;
+    if (msync(c->map, sizeof(cache_header_t), MS_SYNC) < 0) {
+        perror("msync cache"); //Error Handling for msync
+        return -1;
+    }
+    return 0;
+}
+
+// Flush the rewrite, then clear the flag
+void cache_end(fp_cache_t *c) {
+    if (msync(c->map, c->size, MS_SYNC) < 0) {
+        perror("msync cache"); //Error Handling for msync
+        return;     // stays dirty: the next open starts afresh
+    }
+    c->hdr->dirty = 0;
+}
+
+// Add (or replace) the fingerprints of the file, evicting as needed
+void cache_store(fp_cache_t *c, const struct stat *st, const fingerprint_t *fp, size_t nblocks) {
+    size_t bytes = nblocks * sizeof(fingerprint_t);
+    if (bytes > c->data_cap) return;    // would never fit
+    if (cache_begin(c) < 0) return;
+
+    // Older versions of the same file are stale now
+    int evicted = 0;
+    for (uint32_t i = 0; i < c->hdr->nentries; ) {
+        cache_entry_t *e = &c->entries[i];
+        if (e->dev == (uint64_t)st->st_dev && e->ino == (uint64_t)st->st_ino) {
+            cache_remove(c, i);
+            evicted = 1;
+        } else {
+            i++;
+        }
+    }
+    if (evicted) cache_compact(c);
+
+    while (c->hdr->nentries == CACHE_ENTRIES || c->data_cap - c->hdr->data_used < bytes) {
+        uint32_t lru = 0;
+        for (uint32_t i = 1; i < c->hdr->nentries; i++)
+            if (c->entries[i].last_used < c->entries[lru].last_used) lru = i;
+        cache_remove(c, lru);
+        cache_compact(c);
+    }
+
+    memcpy(c->data + c->hdr->data_used, fp, bytes);
+    cache_entry_t *e = &c->entries[c->hdr->nentries];
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime_sec = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+    e->last_used = ++c->hdr->clock;
+    e->offset = c->hdr->data_used;
+    e->nblocks = nblocks;
+    c->hdr->data_used += bytes;
+    c->hdr->nentries++;
+    cache_end(c);
+}
+
+typedef struct {
+    const unsigned char *m;
+    size_t size;
+    size_t nblocks;
+    atomic_size_t next;
+    fingerprint_t *fp;
+} fp_job_t;
+
+void *fp_worker(void *arg) {
+    fp_job_t *job = (fp_job_t *)arg;
+    for (;;) {
+        size_t b = atomic_fetch_add(&job->next, 1);
+        if (b >= job->nblocks) return NULL;
+        size_t off = b * CACHE_BLOCK;
+        size_t n = job->size - off < CACHE_BLOCK ? job->size - off : CACHE_BLOCK;
+        job->fp[b] = hash128(job->m + off, n);
+    }
+}
+
+// Fingerprints of a mapped file, from the cache or computed and stored;
+// *hit tells which. NULL if out of memory.
+fingerprint_t *cache_fingerprints(fp_cache_t *c, int fd, const unsigned char *m, size_t size,
+                                  int threads, int *hit) {
+    struct stat st;
+    size_t nblocks = (size + CACHE_BLOCK - 1) / CACHE_BLOCK;
+    *hit = 0;
+    if (fstat(fd, &st) < 0) return NULL;
+
+    fingerprint_t *fp = cache_lookup(c, &st, nblocks);
+    if (fp) {
+        *hit = 1;
+        return fp;
+    }
+
+    fp_job_t job = { m, size, nblocks, 0, malloc(nblocks * sizeof(fingerprint_t)) };
+    if (!job.fp) return NULL;
+    pthread_t tid[MAX_THREADS];
+    if ((size_t)threads > nblocks) threads = (int)nblocks;
+    int started = 0;
+    for (; started < threads; started++)
+        if (pthread_create(&tid[started], NULL, fp_worker, &job) != 0) break;
+    if (started == 0) fp_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+
+    cache_store(c, &st, job.fp, nblocks);
+    return job.fp;
+}
+
+// Which CACHE_BLOCKs of [0, min) have the same fingerprint in both files;
+// NULL if the cache cannot be used, and the diff then reads everything
+unsigned char *cache_clean_blocks(const char *path, size_t cache_size, int threads,
+                                  int fd1, const unsigned char *m1, size_t size1,
+                                  int fd2, const unsigned char *m2, size_t size2) {
+    fp_cache_t c;
+    if (cache_open(&c, path, cache_size) < 0) return NULL;
+
+    int hit1, hit2;
+    fingerprint_t *f1 = cache_fingerprints(&c, fd1, m1, size1, threads, &hit1);
+    fingerprint_t *f2 = cache_fingerprints(&c, fd2, m2, size2, threads, &hit2);
+    cache_close(&c);
+
+    size_t min = size1 < size2 ? size1 : size2;
+    size_t nblocks = (min + CACHE_BLOCK - 1) / CACHE_BLOCK, dirty = 0;
+    unsigned char *clean = f1 && f2 ? calloc(nblocks, 1) : NULL;
+    for (size_t b = 0; clean && b < nblocks; b++) {
+        // A block cut short by the end of only one file hashes differently
+        int comparable = (b + 1) * CACHE_BLOCK <= min || size1 == size2;
+        clean[b] = comparable && memcmp(&f1[b], &f2[b], sizeof(fingerprint_t)) == 0;
+        dirty += !clean[b];
+    }
+    if (clean)
+        printf("Fingerprint cache: file1 %s, file2 %s, %zu of %zu blocks to compare\n",
+               hit1 ? "hit" : "miss", hit2 ? "hit" : "miss", dirty, nblocks);
+    free(f1);
+    free(f2);
+    return clean;
 }
 
 // BINARY DIFF: 
-   
-long binary_diff(int fd1, int fd2, long size1, long size2) {
-    unsigned char b1, b2;
+// Both files are mmap'd and compared a vector at a time, so there is no
+// per-byte system call and no copy into user buffers. The common prefix
+// is cut into DIFF_CHUNK work items that threads claim from an atomic
+// counter; each item keeps its own count and ranges, and the items are
+// merged in file order, so the result is the same for any thread count.
+
+typedef struct {
+    const unsigned char *m1, *m2;
+    size_t size;                // common prefix length
+    size_t nchunks;
+    atomic_size_t next;         // next unclaimed chunk
+    diff_fn fn;
+    size_t *counts;             // per chunk
+    range_list_t *ranges;       // per chunk
+    const unsigned char *clean; // per CACHE_BLOCK, 1 = fingerprints match; may be NULL
+} diff_job_t;
+
+void *diff_worker(void *arg) {
+    diff_job_t *job = (diff_job_t *)arg;
+    for (;;) {
+        size_t c = atomic_fetch_add(&job->next, 1);
+        if (c >= job->nchunks) return NULL;
+        size_t off = c * DIFF_CHUNK;
+        size_t n = job->size - off < DIFF_CHUNK ? job->size - off : DIFF_CHUNK;
+        if (!job->clean) {
+            job->counts[c] = job->fn(job->m1 + off, job->m2 + off, n, off, &job->ranges[c]);
+            continue;
+        }
+        // Only the blocks whose fingerprints differ are read
+        size_t count = 0;
+        for (size_t b = off; b < off + n; b += CACHE_BLOCK) {
+            size_t k = off + n - b < CACHE_BLOCK ? off + n - b : CACHE_BLOCK;
+            if (!job->clean[b / CACHE_BLOCK])
+                count += job->fn(job->m1 + b, job->m2 + b, k, b, &job->ranges[c]);
+        }
+        job->counts[c] = count;
+    }
+}
+
+// Output buffer for long reports: text is formatted by hand into one large
+// buffer and handed to write() when it fills, instead of a printf per line
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int fd;
+} out_buf_t;
+
+void out_flush(out_buf_t *o) {
+    size_t done = 0;
+    while (done < o->len) {
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+        if (n < 0) break;       // stdout gone: nothing sensible left to do
+        done += n;
+    }
+    o->len = 0;
+}
+
+void out_bytes(out_buf_t *o, const char *p, size_t n) {
+    if (o->cap - o->len < n) out_flush(o);
+    if (o->cap < n) {
+        o->buf = (char *)p;     // too big to buffer: write it as is
+        o->len = n;
+        out_flush(o);
+        o->buf = NULL;
+        return;
+    }
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+}
+
+void out_str(out_buf_t *o, const char *s) {
+    out_bytes(o, s, strlen(s));
+}
+
+void out_u64(out_buf_t *o, unsigned long long v) {
+    char tmp[20];
+    int i = sizeof(tmp);
+    do {
+        tmp[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    out_bytes(o, tmp + i, sizeof(tmp) - i);
+}
+
+// "      fileN: 1f 8b 08 ..." for the first HEX_EXCERPT bytes of a range
+void out_excerpt(out_buf_t *o, const char *label, const unsigned char *m, long size,
+                 const diff_range_t *r) {
+    static const char digits[] = "0123456789abcdef";
+    char line[HEX_EXCERPT * 3 + 8];
+    size_t n = 0;
+
+    out_str(o, label);
+    if ((long long)r->offset >= size) {
+        out_str(o, " (past end of file)\n");
+        return;
+    }
+    unsigned long long avail = size - r->offset;
+    unsigned long long k = r->length < avail ? r->length : avail;
+    if (k > HEX_EXCERPT) k = HEX_EXCERPT;
+    for (unsigned long long i = 0; i < k; i++) {
+        unsigned char c = m[r->offset + i];
+        line[n++] = ' ';
+        line[n++] = digits[c >> 4];
+        line[n++] = digits[c & 15];
+    }
+    if (r->length > k && avail > k) {
+        memcpy(line + n, " ...", 4);
+        n += 4;
+    }
+    line[n++] = '\n';
+    out_bytes(o, line, n);
+}
+
+// List the stored ranges, with a hex excerpt of both files if asked
+void print_ranges(const range_list_t *all, const unsigned char *m1, long size1,
+                  const unsigned char *m2, long size2, int hex) {
+    fflush(stdout);     // keep the order with what printf already buffered
+
+    out_buf_t o = { malloc(OUT_BUF), 0, OUT_BUF, STDOUT_FILENO };
+    if (!o.buf) o.cap = 0;
+    char *buf = o.buf;
+
+    for (size_t i = 0; i < all->count; i++) {
+        out_str(&o, "  [");
+        out_u64(&o, all->v[i].offset);
+        out_str(&o, ", ");
+        out_u64(&o, all->v[i].length);
+        out_str(&o, "]\n");
+        if (hex) {
+            out_excerpt(&o, "      file1:", m1, size1, &all->v[i]);
+            out_excerpt(&o, "      file2:", m2, size2, &all->v[i]);
+        }
+    }
+    if (all->total > all->count) {
+        out_str(&o, "  ... ");
+        out_u64(&o, all->total - all->count);
+        out_str(&o, all->failed ? " more not listed (out of memory)\n"
+                                : " more not listed (--max-ranges)\n");
+    }
+    out_flush(&o);
+    free(buf);
+}
+
+long binary_diff(int fd1, int fd2, long size1, long size2, int threads, size_t max_ranges, int hex,
+                 const char *cache_path, size_t cache_size) {
     long diff = 0;
+    range_list_t all = { .limit = max_ranges };
+    unsigned char *m1 = NULL, *m2 = NULL;
 
     printf("\n- BINARY DIFF -\n");
 
     long min = (size1 < size2) ? size1 : size2;
+    diff_kernel_t kernel = select_diff_kernel();
 
-    for (long i = 0; i < min; i++) {
-        if (read(fd1, &b1, 1) != 1 || read(fd2, &b2, 1) != 1) {   //Error Handling for read
-            fprintf(stderr, "Read error during binary diff.\n")
-            break;
+    // Whole files are mapped so the excerpts can show either one's tail
+    if (size1 > 0) m1 = mmap(NULL, size1, PROT_READ, MAP_PRIVATE, fd1, 0);
+    if (size2 > 0) m2 = mmap(NULL, size2, PROT_READ, MAP_PRIVATE, fd2, 0);
+    if (m1 == MAP_FAILED || m2 == MAP_FAILED) {
+        perror("mmap"); //Error Handling for mmap
+        if (m1 && m1 != MAP_FAILED) munmap(m1, size1);
+        if (m2 && m2 != MAP_FAILED) munmap(m2, size2);
+        return -1;
+    }
+
+    unsigned char *clean = NULL;
+    if (min > 0 && cache_path)
+        clean = cache_clean_blocks(cache_path, cache_size, threads, fd1, m1, size1, fd2, m2, size2);
+
+    if (min > 0) {
+        if (!clean) {
+            madvise(m1, min, MADV_SEQUENTIAL);
+            madvise(m2, min, MADV_SEQUENTIAL);
+        }
+
+        diff_job_t job = { m1, m2, min, (min + DIFF_CHUNK - 1) / DIFF_CHUNK, 0, kernel.fn,
+                           NULL, NULL, clean };
+        job.counts = calloc(job.nchunks, sizeof(*job.counts));
+        job.ranges = calloc(job.nchunks, sizeof(*job.ranges));
+        pthread_t tid[MAX_THREADS];
+        if ((size_t)threads > job.nchunks) threads = (int)job.nchunks;
+
+        int started = 0;
+        if (job.counts && job.ranges) {
+            for (size_t c = 0; c < job.nchunks; c++)
+                job.ranges[c].limit = max_ranges;
+            for (; started < threads; started++)
+                if (pthread_create(&tid[started], NULL, diff_worker, &job) != 0) break;
+            if (started == 0) diff_worker(&job);   // no threads: do it here
+            for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+        } else {
+            fprintf(stderr, "Out of memory for %zu diff chunks.\n", job.nchunks);
+        }
+
+        // Merge in file order; a range cut by a chunk boundary is rejoined
+        for (size_t c = 0; job.counts && job.ranges && c < job.nchunks; c++) {
+            diff += (long)job.counts[c];
+            range_append(&all, &job.ranges[c]);
+            free(job.ranges[c].v);
+        }
+        int ok = job.counts && job.ranges;
+        free(job.counts);
+        free(job.ranges);
+        free(clean);
+        if (!ok) {
+            munmap(m1, size1);
+            munmap(m2, size2);
+            return -1;
         }
-        if (b1 != b2) diff++;
     }
 
     // Add remaining size difference
     diff += labs(size1 - size2);
+    if (size1 != size2)
+        range_add(&all, min, labs(size1 - size2));
 
+    printf("Compare kernel: %s, %d thread%s\n", kernel.name, threads, threads == 1 ? "" : "s");
     printf("Different bytes: %ld\n", diff);
+    printf("Different ranges: %zu\n", all.total);
+    print_ranges(&all, m1, size1, m2, size2, hex);
+
+    free(all.v);
+    if (m1) munmap(m1, size1);
+    if (m2) munmap(m2, size2);
     return diff;
 }
 
+// QUICK: 
+// Equality only, like cmp -s: nothing is printed and the answer is the
+// exit status, 0 identical, 1 different, 2 trouble. Different sizes
+// answer at once; otherwise the first and last pages are compared (edits
+// cluster at the ends: headers, trailers, appended records) and then the
+// rest in QUICK_BLOCK pieces, stopping at the first difference. Pieces are
+// handed out alternately from the front and the back, and with more than
+// one thread several are compared at once, so a difference near the end
+// of a huge file is found without first reading everything before it.
+
+typedef struct {
+    const unsigned char *m1, *m2;
+    size_t size;
+    size_t nblocks;
+    atomic_size_t next;     // next unclaimed piece
+    atomic_int differ;
+} quick_job_t;
+
+void *quick_worker(void *arg) {
+    quick_job_t *job = (quick_job_t *)arg;
+    while (!atomic_load_explicit(&job->differ, memory_order_relaxed)) {
+        size_t c = atomic_fetch_add(&job->next, 1);
+        if (c >= job->nblocks) break;
+        size_t b = c % 2 == 0 ? c / 2 : job->nblocks - 1 - c / 2;
+        size_t off = b * QUICK_BLOCK;
+        size_t n = job->size - off < QUICK_BLOCK ? job->size - off : QUICK_BLOCK;
+        if (memcmp(job->m1 + off, job->m2 + off, n) != 0)
+            atomic_store(&job->differ, 1);
+    }
+    return NULL;
+}
+
+// Read up to n bytes, retrying short reads; -1 on error
+ssize_t read_full(int fd, unsigned char *buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r < 0) return -1;
+        if (r == 0) break;
+        got += r;
+    }
+    return got;
+}
+
+// For pipes and other files that cannot be mapped: compare as read
+int quick_stream(int fd1, int fd2) {
+    unsigned char *b1 = malloc(QUICK_BLOCK), *b2 = malloc(QUICK_BLOCK);
+    int result = 2;
+
+    while (b1 && b2) {
+        ssize_t n1 = read_full(fd1, b1, QUICK_BLOCK);
+        ssize_t n2 = read_full(fd2, b2, QUICK_BLOCK);
+        if (n1 < 0 || n2 < 0) {
+            perror("read"); //Error Handling for read
+            break;
+        }
+        if (n1 != n2 || memcmp(b1, b2, n1) != 0) {
+            result = 1;
+            break;
+        }
+        if (n1 == 0) {
+            result = 0;
+            break;
+        }
+    }
+    free(b1);
+    free(b2);
+    return result;
+}
+
+// Returns the exit status: 0 identical, 1 different, 2 error
+int quick_compare(int fd1, int fd2, const struct stat *s1, const struct stat *s2, int threads) {
+    if (!S_ISREG(s1->st_mode) || !S_ISREG(s2->st_mode))
+        return quick_stream(fd1, fd2);
+    if (s1->st_size != s2->st_size) return 1;
+    if (s1->st_dev == s2->st_dev && s1->st_ino == s2->st_ino) return 0;
+    if (s1->st_size == 0) return 0;
+
+    size_t size = s1->st_size;
+    unsigned char *m1 = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd1, 0);
+    unsigned char *m2 = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd2, 0);
+    if (m1 == MAP_FAILED || m2 == MAP_FAILED) {
+        if (m1 != MAP_FAILED) munmap(m1, size);
+        if (m2 != MAP_FAILED) munmap(m2, size);
+        return quick_stream(fd1, fd2);
+    }
+
+    // First and last page
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t head = size < page ? size : page;
+    int result = memcmp(m1, m2, head) != 0 || memcmp(m1 + size - head, m2 + size - head, head) != 0;
+
+    if (!result && size > 2 * head) {
+        quick_job_t job = { m1, m2, size, (size + QUICK_BLOCK - 1) / QUICK_BLOCK, 0, 0 };
+        pthread_t tid[MAX_THREADS];
+        if ((size_t)threads > job.nblocks / 4) threads = job.nblocks / 4;   // not worth it below that
+
+        int started = 0;
+        for (; started < threads; started++)
+            if (pthread_create(&tid[started], NULL, quick_worker, &job) != 0) break;
+        if (started == 0) quick_worker(&job);
+        for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+        result = atomic_load(&job.differ);
+    }
+
+    munmap(m1, size);
+    munmap(m2, size);
+    return result;
+}
+
+// DELTA: 
+// rsync's algorithm, with both files local. file1 is cut into fixed blocks
+// indexed by a rolling checksum; a window slides over file2 one byte at a
+// time and, when its checksum hits a block, the strong hash and then the
+// bytes themselves are compared. Matches become COPY records (an offset
+// into file1), everything else DATA records carrying the bytes, so an
+// insertion near the front costs one DATA record instead of a full-file
+// difference. After a match the block that follows it in file1 is tried
+// first with a plain memcmp, which makes long unchanged stretches cheap.
+//
+// Patch file: patch_header_t, then records, all lengths and offsets as
+// LEB128 varints:
+//   PATCH_COPY  <offset - end of previous copy, zigzag> <length>
+//   PATCH_DATA  <length> <bytes>
+//   PATCH_END
+
+#define PATCH_MAGIC "FDPATCH1"
+#define PATCH_END  0
+#define PATCH_COPY 1
+#define PATCH_DATA 2
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t reserved;
+    uint64_t source_size;
+    uint64_t target_size;
+    uint64_t source_hash;   // hash64 of file1, checked before patching
+    uint64_t target_hash;   // hash64 of file2, checked after
+} patch_header_t;
+
+// Rolling checksum of a window: a = sum of bytes, b = sum of a over the
+// window, i.e. each byte weighted by its distance from the end
+typedef struct {
+    uint32_t a, b;
+} weak_sum_t;
+
+weak_sum_t weak_sum(const unsigned char *p, size_t n) {
+    weak_sum_t w = {0, 0};
+    for (size_t i = 0; i < n; i++) {
+        w.a += p[i];
+        w.b += w.a;
+    }
+    return w;
+}
+
+// Slide the window of n bytes one byte on: drop out, take in
+static inline void weak_roll(weak_sum_t *w, unsigned char out, unsigned char in, size_t n) {
+    w->a += in - out;
+    w->b += w->a - (uint32_t)n * out;
+}
+
+static inline uint64_t weak_key(weak_sum_t w) {
+    return (uint64_t)w.b << 32 | w.a;
+}
+
+typedef struct {
+    const unsigned char *src;   // file1
+    size_t block;
+    size_t nblocks;
+    uint64_t *weak;             // per block
+    uint64_t *strong;           // per block, computed on first use
+    unsigned char *have_strong;
+    long *head, *next;          // hash chains on the weak key
+    size_t mask;
+} block_index_t;
+
+// Index of a block of file1 equal to p[0,block), or -1
+long block_find(block_index_t *ix, const unsigned char *p, uint64_t key) {
+    uint64_t strong = 0;
+    int have = 0;
+    for (long i = ix->head[(key * 0x9e3779b97f4a7c15ULL) >> 32 & ix->mask]; i >= 0; i = ix->next[i]) {
+        if (ix->weak[i] != key) continue;
+        if (!ix->have_strong[i]) {
+            ix->strong[i] = hash64(ix->src + i * ix->block, ix->block, DELTA_SEED);
+            ix->have_strong[i] = 1;
+        }
+        if (!have) {
+            strong = hash64(p, ix->block, DELTA_SEED);
+            have = 1;
+        }
+        if (ix->strong[i] == strong && memcmp(ix->src + i * ix->block, p, ix->block) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void put_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    putc((int)v, f);
+}
+
+// 0 on success, -1 if the varint runs past end
+int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+typedef struct {
+    FILE *out;
+    uint64_t copy_off, copy_len;    // pending COPY, merged while contiguous
+    uint64_t prev_end;              // end of the last COPY written
+    uint64_t copies, copied, literal;
+} patch_writer_t;
+
+void patch_flush_copy(patch_writer_t *w) {
+    if (!w->copy_len) return;
+    int64_t rel = (int64_t)(w->copy_off - w->prev_end);
+    putc(PATCH_COPY, w->out);
+    put_varint(w->out, ((uint64_t)rel << 1) ^ (uint64_t)(rel >> 63));
+    put_varint(w->out, w->copy_len);
+    w->prev_end = w->copy_off + w->copy_len;
+    w->copies++;
+    w->copied += w->copy_len;
+    w->copy_len = 0;
+}
+
+void patch_copy(patch_writer_t *w, uint64_t off, uint64_t len) {
+    if (w->copy_len && w->copy_off + w->copy_len == off) {
+        w->copy_len += len;
+        return;
+    }
+    patch_flush_copy(w);
+    w->copy_off = off;
+    w->copy_len = len;
+}
+
+void patch_data(patch_writer_t *w, const unsigned char *p, size_t len) {
+    if (!len) return;
+    patch_flush_copy(w);
+    putc(PATCH_DATA, w->out);
+    put_varint(w->out, len);
+    fwrite(p, 1, len, w->out);
+    w->literal += len;
+}
+
+// Extend a copy that ended at file1 offset src byte by byte; returns the
+// number of bytes added
+size_t delta_extend(patch_writer_t *w, const unsigned char *m1, size_t size1, size_t src,
+                    const unsigned char *m2, size_t size2, size_t pos) {
+    size_t n = 0;
+    while (pos + n < size2 && src + n < size1 && m1[src + n] == m2[pos + n])
+        n++;
+    if (n) patch_copy(w, src, n);
+    return n;
+}
+
+// Map the first size bytes of fd read-only; empty files give a NULL map
+int map_file(int fd, size_t size, const unsigned char **m) {
+    *m = NULL;
+    if (size == 0) return 0;
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap"); //Error Handling for mmap
+        return -1;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+    *m = p;
+    return 0;
+}
+
+// Delta and patch output: refused if it names one of the (mapped) inputs,
+// and written to a temporary file next to it that only replaces the
+// target once complete, so a failed run never leaves a partial file.
+// Returns the temporary file's descriptor, its path in tmp.
+int output_open(const char *name, int fd1, int fd2, char *tmp, size_t len) {
+    struct stat so, s1, s2;
+    if (stat(name, &so) == 0 && fstat(fd1, &s1) == 0 && fstat(fd2, &s2) == 0
+        && ((so.st_dev == s1.st_dev && so.st_ino == s1.st_ino)
+            || (so.st_dev == s2.st_dev && so.st_ino == s2.st_ino))) {
+        fprintf(stderr, "Output %s is one of the input files.\n", name);
+        return -1;
+    }
+
+    if ((size_t)snprintf(tmp, len, "%s.XXXXXX", name) >= len) {
+        fprintf(stderr, "Output path too long.\n");
+        return -1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror("mkstemp"); //Error Handling for mkstemp
+        return -1;
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0644 & ~mask);   // as open(name, O_CREAT, 0644) would
+    return fd;
+}
+
+// Put a finished output in place, or throw a failed one away
+int output_close(const char *tmp, const char *name, int ok) {
+    if (ok && rename(tmp, name) == 0) return 0;
+    if (ok) perror("rename"); //Error Handling for rename
+    unlink(tmp);
+    return -1;
+}
+
+// Write a patch that turns file1 into file2; -1 on error
+long delta_diff(int fd1, int fd2, size_t size1, size_t size2, const char *patch_name, size_t block) {
+    const unsigned char *m1, *m2;
+    long result = -1;
+
+    printf("\n- DELTA -\n");
+
+    if (block == 0) {
+        // As rsync does: about sqrt(size) (here a power of two), within bounds
+        block = 8;
+        while (block * block < size1) block *= 2;
+        if (block < DELTA_MIN_BLOCK) block = DELTA_MIN_BLOCK;
+        if (block > DELTA_MAX_BLOCK) block = DELTA_MAX_BLOCK;
+    }
+
+    if (map_file(fd1, size1, &m1) < 0) return -1;
+    if (map_file(fd2, size2, &m2) < 0) {
+        if (m1) munmap((void *)m1, size1);
+        return -1;
+    }
+
+    block_index_t ix = { m1, block, size1 / block, NULL, NULL, NULL, NULL, NULL, 0 };
+    size_t nheads = 16;
+    while (nheads < 2 * ix.nblocks) nheads *= 2;
+    ix.mask = nheads - 1;
+    ix.weak = malloc((ix.nblocks + 1) * sizeof(uint64_t));
+    ix.strong = malloc((ix.nblocks + 1) * sizeof(uint64_t));
+    ix.have_strong = calloc(ix.nblocks + 1, 1);
+    ix.next = malloc((ix.nblocks + 1) * sizeof(long));
+    ix.head = malloc(nheads * sizeof(long));
+
+    char tmp[PATH_MAX];
+    int out_fd = output_open(patch_name, fd1, fd2, tmp, sizeof(tmp));
+    FILE *out = out_fd < 0 ? NULL : fdopen(out_fd, "wb");
+    if (out_fd >= 0 && !out) {
+        perror("fdopen"); //Error Handling for fdopen
+        close(out_fd);
+        output_close(tmp, patch_name, 0);
+    }
+    if (out) setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    if (out && ix.weak && ix.strong && ix.have_strong && ix.next && ix.head) {
+        // Later blocks are pushed first so chains list file1 in order
+        memset(ix.head, 0xff, nheads * sizeof(long));
+        for (size_t i = ix.nblocks; i-- > 0; ) {
+            ix.weak[i] = weak_key(weak_sum(m1 + i * block, block));
+            size_t h = (ix.weak[i] * 0x9e3779b97f4a7c15ULL) >> 32 & ix.mask;
+            ix.next[i] = ix.head[h];
+            ix.head[h] = (long)i;
+        }
+
+        patch_header_t hdr = { PATCH_MAGIC, (uint32_t)block, 0, size1, size2,
+                               hash64(m1, size1, 0), hash64(m2, size2, 0) };
+        fwrite(&hdr, sizeof(hdr), 1, out);
+
+        patch_writer_t w = { out, 0, 0, 0, 0, 0, 0 };
+        size_t pos = 0, lit = 0;        // window start, start of pending literal
+        long expect = -1;               // block after the last match
+        weak_sum_t sum = {0, 0};
+        int fresh = 1;                  // sum must be recomputed at pos
+
+        while (ix.nblocks && pos + block <= size2) {
+            long hit = -1;
+            if (expect >= 0) {
+                if ((size_t)expect < ix.nblocks && memcmp(m1 + expect * block, m2 + pos, block) == 0) {
+                    hit = expect;
+                } else {
+                    // The run of blocks ended; the copy may still go on part way
+                    pos += delta_extend(&w, m1, size1, expect * block, m2, size2, pos);
+                    lit = pos;
+                    expect = -1;
+                    fresh = 1;
+                    continue;
+                }
+            } else {
+                if (fresh) sum = weak_sum(m2 + pos, block);
+                fresh = 0;
+                hit = block_find(&ix, m2 + pos, weak_key(sum));
+            }
+
+            if (hit >= 0) {
+                // A new match may also cover the end of the pending literal
+                size_t back = 0;
+                if (expect < 0)
+                    while (back < pos - lit && back < hit * block
+                           && m1[hit * block - back - 1] == m2[pos - back - 1])
+                        back++;
+                patch_data(&w, m2 + lit, pos - back - lit);
+                patch_copy(&w, (uint64_t)hit * block - back, block + back);
+                pos += block;
+                lit = pos;
+                expect = hit + 1;
+                fresh = 1;
+                continue;
+            }
+
+            if (pos + block < size2) {
+                weak_roll(&sum, m2[pos], m2[pos + block], block);
+            }
+            pos++;
+        }
+        if (expect >= 0) {
+            pos += delta_extend(&w, m1, size1, expect * block, m2, size2, pos);
+            lit = pos;
+        }
+        patch_data(&w, m2 + lit, size2 - lit);
+        patch_flush_copy(&w);
+        putc(PATCH_END, out);
+
+        if (fflush(out) != 0 || ferror(out)) {
+            perror("write"); //Error Handling for write
+        } else {
+            long patch_size = ftell(out);
+            printf("Block size: %zu (%zu blocks)\n", block, ix.nblocks);
+            printf("Copied: %llu bytes in %llu ranges\n",
+                   (unsigned long long)w.copied, (unsigned long long)w.copies);
+            printf("Literal: %llu bytes\n", (unsigned long long)w.literal);
+            printf("Patch: %ld bytes written to %s\n", patch_size, patch_name);
+            result = patch_size;
+        }
+    } else if (out) {
+        fprintf(stderr, "Out of memory for %zu delta blocks.\n", ix.nblocks);
+    }
+
+    if (out && fclose(out) != 0 && result >= 0) {
+        perror("close"); //Error Handling for close
+        result = -1;
+    }
+    if (out && output_close(tmp, patch_name, result >= 0) < 0)
+        result = -1;
+    free(ix.weak);
+    free(ix.strong);
+    free(ix.have_strong);
+    free(ix.next);
+    free(ix.head);
+    if (m1) munmap((void *)m1, size1);
+    if (m2) munmap((void *)m2, size2);
+    return result;
+}
+
+// Write the records of a patch to out; returns the bytes written, or -1 if
+// the records are damaged or do not add up to target_size
+long long patch_records(const unsigned char *p, const unsigned char *end, const unsigned char *m1,
+                        size_t size1, uint64_t target_size, int out) {
+    uint64_t written = 0, prev_end = 0;
+
+    while (p < end) {
+        int op = *p++;
+        if (op == PATCH_END)
+            return written == target_size ? (long long)written : -1;
+
+        uint64_t a, len;
+        const unsigned char *from;
+        if (op == PATCH_COPY) {
+            if (get_varint(&p, end, &a) < 0 || get_varint(&p, end, &len) < 0) return -1;
+            uint64_t off = prev_end + (uint64_t)((int64_t)(a >> 1) ^ -(int64_t)(a & 1));
+            if (off > size1 || len > size1 - off) return -1;
+            from = m1 + off;
+            prev_end = off + len;
+        } else if (op == PATCH_DATA) {
+            if (get_varint(&p, end, &len) < 0 || len > (uint64_t)(end - p)) return -1;
+            from = p;
+            p += len;
+        } else {
+            return -1;
+        }
+        if (len > target_size - written) return -1;
+
+        // Straight from the mappings, no staging copy
+        while (len > 0) {
+            ssize_t n = write(out, from, len);
+            if (n < 0) {
+                perror("write"); //Error Handling for write
+                return -1;
+            }
+            from += n;
+            len -= n;
+            written += n;
+        }
+    }
+    return -1;      // no PATCH_END
+}
+
+// Rebuild file2 from file1 and a patch written by delta_diff; -1 on error
+long patch_apply(int fd1, int fdp, size_t size1, size_t psize, const char *out_name) {
+    const unsigned char *m1, *mp, *mo;
+    patch_header_t hdr;
+    long result = -1;
+
+    printf("\n- PATCH -\n");
+
+    if (map_file(fd1, size1, &m1) < 0) return -1;
+    if (map_file(fdp, psize, &mp) < 0) {
+        if (m1) munmap((void *)m1, size1);
+        return -1;
+    }
+
+    int out = -1;
+    char tmp[PATH_MAX];
+    if (psize < sizeof(hdr) || memcmp(mp, PATCH_MAGIC, 8) != 0) {
+        fprintf(stderr, "Not a patch file.\n");
+    } else if (memcpy(&hdr, mp, sizeof(hdr)), hdr.source_size != size1
+               || hdr.source_hash != hash64(m1, size1, 0)) {
+        fprintf(stderr, "Patch was made against a different file1.\n");
+    } else if ((out = output_open(out_name, fd1, fdp, tmp, sizeof(tmp))) >= 0) {
+        long long written = patch_records(mp + sizeof(hdr), mp + psize, m1, size1,
+                                          hdr.target_size, out);
+        if (written < 0) {
+            fprintf(stderr, "Patch file is truncated or damaged.\n");
+        } else if (map_file(out, written, &mo) == 0) {
+            // Check what was written against the hash of the original file2
+            uint64_t h = hash64(mo, written, 0);
+            if (mo) munmap((void *)mo, written);
+            if (h != hdr.target_hash) {
+                fprintf(stderr, "Rebuilt file does not match the patch checksum.\n");
+            } else {
+                printf("Rebuilt: %lld bytes written to %s\n", written, out_name);
+                printf("Checksum: OK\n");
+                result = (long)written;
+            }
+        }
+    }
+
+    if (out >= 0 && close(out) < 0 && result >= 0) {
+        perror("close"); //Error Handling for close
+        result = -1;
+    }
+    if (out >= 0 && output_close(tmp, out_name, result >= 0) < 0)
+        result = -1;
+    if (m1) munmap((void *)m1, size1);
+    if (mp) munmap((void *)mp, psize);
+    return result;
+}
+
+// DIRECTORY DIFF: 
+// Both trees are walked together, one directory level at a time: each
+// directory is read with getdents64 on a descriptor from openat, its
+// entries are stat'ed relative to it and sorted by name, and the two
+// lists are merged. Only pairs that metadata cannot settle are compared
+// by content: the same inode on the same device is equal, different
+// types or sizes are different. The rest are queued and handed to a
+// worker pool that counts differing bytes with the binary diff kernel.
+// Results are printed in walk order, which is sorted by path.
+
+typedef struct {
+    char *name;
+    struct stat st;
+} dir_entry_t;
+
+typedef struct {
+    char *path;             // relative to both roots
+    char status;            // 'A' added, 'D' removed, 'M' modified, '=' same, '!' error
+    int is_dir;
+    const char *why;        // for 'M' without a byte count
+    off_t size1, size2;
+    long long diff;         // differing bytes, -1 if not counted
+} dir_result_t;
+
+typedef struct {
+    const char *root1, *root2;
+    dir_result_t *v;
+    size_t count, cap;
+    size_t *jobs;           // indexes into v of pairs to compare by content
+    size_t njobs, jobs_cap;
+    size_t skipped;         // pairs settled by metadata alone
+    int failed;
+} dir_walk_t;
+
+typedef struct {
+    dir_walk_t *w;
+    diff_fn fn;
+    atomic_size_t next;
+} dir_job_t;
+
+int dir_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const dir_entry_t *)a)->name, ((const dir_entry_t *)b)->name);
+}
+
+void dir_entries_free(dir_entry_t *e, size_t n) {
+    for (size_t i = 0; i < n; i++) free(e[i].name);
+    free(e);
+}
+
+// Read and stat every entry of the directory fd, sorted by name; -1 on error
+long dir_read(int fd, dir_entry_t **out) {
+    char buf[DIR_BUF];
+    dir_entry_t *v = NULL;
+    size_t n = 0, cap = 0;
+
+    for (;;) {
+        long got = syscall(__NR_getdents64, fd, buf, sizeof(buf));
+        if (got < 0) {
+            dir_entries_free(v, n);
+            return -1;
+        }
+        if (got == 0) break;
+
+        for (long off = 0; off < got; ) {
+            // struct linux_dirent64: ino, off, reclen, type, name
+            unsigned short reclen;
+            memcpy(&reclen, buf + off + 16, sizeof(reclen));
+            const char *name = buf + off + 19;
+            off += reclen;
+
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                dir_entry_t *nv = realloc(v, cap * sizeof(*v));
+                if (!nv) {
+                    dir_entries_free(v, n);
+                    return -1;
+                }
+                v = nv;
+            }
+            if (fstatat(fd, name, &v[n].st, AT_SYMLINK_NOFOLLOW) < 0) continue;  // gone since
+            if (!(v[n].name = strdup(name))) {
+                dir_entries_free(v, n);
+                return -1;
+            }
+            n++;
+        }
+    }
+    qsort(v, n, sizeof(*v), dir_entry_cmp);
+    *out = v;
+    return (long)n;
+}
+
+// Append a result; returns its index or -1
+long dir_result(dir_walk_t *w, const char *rel, const char *name, char status, int is_dir,
+                const struct stat *s1, const struct stat *s2) {
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 256;
+        dir_result_t *v = realloc(w->v, cap * sizeof(*v));
+        if (!v) {
+            w->failed = 1;
+            return -1;
+        }
+        w->v = v;
+        w->cap = cap;
+    }
+    dir_result_t *r = &w->v[w->count];
+    size_t len = strlen(rel) + strlen(name) + 2;
+    if (!(r->path = malloc(len))) {
+        w->failed = 1;
+        return -1;
+    }
+    snprintf(r->path, len, "%s%s%s", rel, *rel ? "/" : "", name);
+    r->status = status;
+    r->is_dir = is_dir;
+    r->why = NULL;
+    r->size1 = s1 ? s1->st_size : 0;
+    r->size2 = s2 ? s2->st_size : 0;
+    r->diff = -1;
+    return (long)w->count++;
+}
+
+// Compare two symlinks by target
+int links_differ(int fd1, int fd2, const char *name) {
+    char t1[PATH_MAX], t2[PATH_MAX];
+    ssize_t n1 = readlinkat(fd1, name, t1, sizeof(t1));
+    ssize_t n2 = readlinkat(fd2, name, t2, sizeof(t2));
+    return n1 < 0 || n2 < 0 || n1 != n2 || memcmp(t1, t2, n1) != 0;
+}
+
+// Walk the directory pair fd1/fd2 (path rel under both roots)
+void dir_walk(dir_walk_t *w, int fd1, int fd2, const char *rel) {
+    dir_entry_t *e1 = NULL, *e2 = NULL;
+    long n1 = dir_read(fd1, &e1), n2 = dir_read(fd2, &e2);
+
+    if (n1 < 0 || n2 < 0) {
+        fprintf(stderr, "Cannot read directory %s: %s\n", *rel ? rel : ".", strerror(errno));
+        if (n1 >= 0) dir_entries_free(e1, n1);
+        if (n2 >= 0) dir_entries_free(e2, n2);
+        long r = dir_result(w, "", *rel ? rel : ".", '!', 1, NULL, NULL);
+        if (r >= 0) w->v[r].why = "unreadable directory";
+        w->failed = 1;
+        return;
+    }
+
+    long i = 0, j = 0;
+    while (i < n1 || j < n2) {
+        int c = i == n1 ? 1 : j == n2 ? -1 : strcmp(e1[i].name, e2[j].name);
+        if (c < 0) {
+            dir_result(w, rel, e1[i].name, 'D', S_ISDIR(e1[i].st.st_mode), &e1[i].st, NULL);
+            i++;
+            continue;
+        }
+        if (c > 0) {
+            dir_result(w, rel, e2[j].name, 'A', S_ISDIR(e2[j].st.st_mode), NULL, &e2[j].st);
+            j++;
+            continue;
+        }
+
+        const char *name = e1[i].name;
+        struct stat *s1 = &e1[i].st, *s2 = &e2[j].st;
+        i++;
+        j++;
+
+        if (S_ISDIR(s1->st_mode) && S_ISDIR(s2->st_mode)) {
+            if (s1->st_dev == s2->st_dev && s1->st_ino == s2->st_ino) {
+                w->skipped++;       // the same directory: nothing inside can differ
+                continue;
+            }
+            int d1 = openat(fd1, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            int d2 = openat(fd2, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            size_t len = strlen(rel) + strlen(name) + 2;
+            char *sub = malloc(len);
+            if (d1 >= 0 && d2 >= 0 && sub) {
+                snprintf(sub, len, "%s%s%s", rel, *rel ? "/" : "", name);
+                dir_walk(w, d1, d2, sub);
+            } else {
+                fprintf(stderr, "Cannot open directory %s%s%s: %s\n", rel, *rel ? "/" : "", name,
+                        strerror(errno));
+                long r = dir_result(w, rel, name, '!', 1, s1, s2);
+                if (r >= 0) w->v[r].why = "unreadable directory";
+                w->failed = 1;
+            }
+            free(sub);
+            if (d1 >= 0) close(d1);
+            if (d2 >= 0) close(d2);
+            continue;
+        }
+
+        // Settle what metadata can
+        const char *why = NULL;
+        if ((s1->st_mode & S_IFMT) != (s2->st_mode & S_IFMT)) why = "type changed";
+        else if (s1->st_dev == s2->st_dev && s1->st_ino == s2->st_ino) why = "";
+        else if (S_ISLNK(s1->st_mode)) why = links_differ(fd1, fd2, name) ? "link target changed" : "";
+        else if (!S_ISREG(s1->st_mode)) why = s1->st_rdev != s2->st_rdev ? "device changed" : "";
+        else if (s1->st_size != s2->st_size) why = "size changed";
+
+        long r = dir_result(w, rel, name, why && !*why ? '=' : 'M', 0, s1, s2);
+        if (r < 0) continue;
+        if (why) {
+            w->v[r].why = why;
+            w->skipped++;
+            continue;
+        }
+        if (w->njobs == w->jobs_cap) {
+            size_t cap = w->jobs_cap ? w->jobs_cap * 2 : 256;
+            size_t *jobs = realloc(w->jobs, cap * sizeof(*jobs));
+            if (!jobs) {
+                w->failed = 1;
+                continue;
+            }
+            w->jobs = jobs;
+            w->jobs_cap = cap;
+        }
+        w->jobs[w->njobs++] = r;
+    }
+
+    dir_entries_free(e1, n1);
+    dir_entries_free(e2, n2);
+}
+
+// Count the differing bytes of one pair of same-size regular files. Small
+// files are read into buffers: for them a map and unmap cost more than
+// the copy.
+long long dir_compare_file(const char *path1, const char *path2, off_t size, diff_fn fn,
+                           unsigned char *buf1, unsigned char *buf2) {
+    long long diff = -1;
+    if (size == 0) return 0;
+
+    int fd1 = open(path1, O_RDONLY);
+    int fd2 = open(path2, O_RDONLY);
+    if (fd1 >= 0 && fd2 >= 0 && size <= DIR_SMALL_FILE) {
+        if (read_full(fd1, buf1, size) == size && read_full(fd2, buf2, size) == size)
+            diff = (long long)fn(buf1, buf2, size, 0, NULL);
+    } else if (fd1 >= 0 && fd2 >= 0) {
+        unsigned char *m1 = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd1, 0);
+        unsigned char *m2 = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd2, 0);
+        if (m1 != MAP_FAILED && m2 != MAP_FAILED) {
+            madvise(m1, size, MADV_SEQUENTIAL);
+            madvise(m2, size, MADV_SEQUENTIAL);
+            diff = (long long)fn(m1, m2, size, 0, NULL);
+        }
+        if (m1 != MAP_FAILED) munmap(m1, size);
+        if (m2 != MAP_FAILED) munmap(m2, size);
+    }
+    if (fd1 >= 0) close(fd1);
+    if (fd2 >= 0) close(fd2);
+    return diff;
+}
+
+void *dir_worker(void *arg) {
+    dir_job_t *job = (dir_job_t *)arg;
+    dir_walk_t *w = job->w;
+    char path1[PATH_MAX], path2[PATH_MAX];
+    unsigned char *buf = malloc(2 * DIR_SMALL_FILE);
+
+    for (;;) {
+        size_t k = atomic_fetch_add(&job->next, 1);
+        if (k >= w->njobs) break;
+        dir_result_t *r = &w->v[w->jobs[k]];
+        snprintf(path1, sizeof(path1), "%s/%s", w->root1, r->path);
+        snprintf(path2, sizeof(path2), "%s/%s", w->root2, r->path);
+        r->diff = buf ? dir_compare_file(path1, path2, r->size1, job->fn, buf, buf + DIR_SMALL_FILE) : -1;
+        r->status = r->diff < 0 ? '!' : r->diff ? 'M' : '=';
+        if (r->diff < 0) r->why = "unreadable file";
+    }
+    free(buf);
+    return NULL;
+}
+
+// Compare the trees under dir1 and dir2; -1 on error
+long dir_diff(const char *dir1, const char *dir2, int threads) {
+    dir_walk_t w = { dir1, dir2, NULL, 0, 0, NULL, 0, 0, 0, 0 };
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    printf("\n- DIRECTORY DIFF -\n");
+
+    int fd1 = open(dir1, O_RDONLY | O_DIRECTORY);
+    int fd2 = open(dir2, O_RDONLY | O_DIRECTORY);
+    if (fd1 < 0 || fd2 < 0) {
+        perror("open"); //Error Handling for open
+        if (fd1 >= 0) close(fd1);
+        if (fd2 >= 0) close(fd2);
+        return -1;
+    }
+    dir_walk(&w, fd1, fd2, "");
+    close(fd1);
+    close(fd2);
+
+    // Content comparisons
+    diff_kernel_t kernel = select_diff_kernel();
+    dir_job_t job = { &w, kernel.fn, 0 };
+    pthread_t tid[MAX_THREADS];
+    if ((size_t)threads > w.njobs) threads = (int)w.njobs;
+    int started = 0;
+    for (; started < threads; started++)
+        if (pthread_create(&tid[started], NULL, dir_worker, &job) != 0) break;
+    if (started == 0) dir_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+
+    size_t added = 0, removed = 0, modified = 0, same = 0, errors = 0;
+    for (size_t i = 0; i < w.count; i++) {
+        dir_result_t *r = &w.v[i];
+        const char *slash = r->is_dir ? "/" : "";
+        switch (r->status) {
+        case 'A':
+            printf("A  %s%s\n", r->path, slash);
+            added++;
+            break;
+        case 'D':
+            printf("D  %s%s\n", r->path, slash);
+            removed++;
+            break;
+        case 'M':
+            if (r->diff >= 0)
+                printf("M  %s (%lld byte%s)\n", r->path, r->diff, r->diff == 1 ? " differs" : "s differ");
+            else if (strcmp(r->why, "size changed") == 0)
+                printf("M  %s (%s: %lld -> %lld bytes)\n", r->path, r->why,
+                       (long long)r->size1, (long long)r->size2);
+            else
+                printf("M  %s (%s)\n", r->path, r->why);
+            modified++;
+            break;
+        case '!':
+            printf("!  %s%s (%s)\n", r->path, slash, r->why);
+            errors++;
+            break;
+        default:
+            same++;
+        }
+        free(r->path);
+    }
+
+    gettimeofday(&end, NULL);
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+
+    printf("\n - STATS -\n");
+    printf("Added: %zu\nRemoved: %zu\nModified: %zu\nUnchanged: %zu\n", added, removed, modified, same);
+    if (errors) printf("Errors: %zu\n", errors);
+    printf("Compared by content: %zu (%d thread%s), settled by metadata: %zu\n",
+           w.njobs, started ? started : 1, started > 1 ? "s" : "", w.skipped);
+    printf("Time: %ld ms\n", ms);
+
+    free(w.v);
+    free(w.jobs);
+    return w.failed || errors ? -1 : (long)(added + removed + modified);
+}
+
 // MAIN 
+
+void usage(void) {
+    printf("Usage: filediffadvanced [-t threads] [-b block] [-x] [--max-ranges N]\n"
+           "                        [--cache file [--cache-size MiB]] <mode> file1 file2 [output]\n");
+    printf("Modes: text | binary | quick | dir | delta (output = patch) | patch (file2 = patch, output = rebuilt file2)\n");
+}
     
 int main(int argc, char *argv[]) {
 
 
+    // Default to one thread per online CPU
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = ncpu < 1 ? 1 : ncpu > MAX_THREADS ? MAX_THREADS : (int)ncpu;
+
+    size_t block = 0;   // delta block size, 0 = from file1's size
+    size_t max_ranges = MAX_RANGES;
+    int hex = 0;
+    const char *cache_path = NULL;
+    size_t cache_size = (size_t)CACHE_SIZE << 20;
+
+    struct option long_opts[] = {
+        {"threads", required_argument, 0, 't'},
+        {"block", required_argument, 0, 'b'},
+        {"hex", no_argument, 0, 'x'},
+        {"max-ranges", required_argument, 0, 1000},
+        {"cache", required_argument, 0, 1001},
+        {"cache-size", required_argument, 0, 1002},
+        {0, 0, 0, 0}
+    };
+
+    // Usage and option errors exit with 2 in every mode, so quick's
+    // "files differ" status of 1 is never mistaken for one
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:b:x", long_opts, NULL)) != -1) {
+        if (opt == 'x') {
+            hex = 1;
+        } else if (opt == 1000) {
+            char *endp;
+            long long n = strtoll(optarg, &endp, 10);
+            if (*endp != '\0' || *optarg == '\0' || n < 0) {
+                fprintf(stderr, "Invalid range limit: %s\n", optarg);
+                return 2;
+            }
+            max_ranges = (size_t)n;
+        } else if (opt == 1001) {
+            cache_path = optarg;
+        } else if (opt == 1002) {
+            char *endp;
+            long mb = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || mb < 1 || mb > 65536) {
+                fprintf(stderr, "Invalid cache size: %s MiB (1-65536)\n", optarg);
+                return 2;
+            }
+            cache_size = (size_t)mb << 20;
+        } else if (opt == 'b') {
+            char *endp;
+            long b = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || b < 16 || b > 16L << 20) {
+                fprintf(stderr, "Invalid block size: %s (16-%ld)\n", optarg, 16L << 20);
+                return 2;
+            }
+            block = (size_t)b;
+        } else if (opt == 't') {
+            char *endp;
+            long t = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || t < 1 || t > MAX_THREADS) {
+                fprintf(stderr, "Invalid thread count: %s (1-%d)\n", optarg, MAX_THREADS);
+                return 2;
+            }
+            threads = (int)t;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
     // Check argument count
-    if (argc < 4) {
-        printf("Usage: filediffadvanced <mode> file1 file2\n");
-        printf("Modes: text | binary\n");
-        return 1;
+    if (argc - optind < 3) {
+        usage();
+        return 2;
+    }
+
+    char *mode = argv[optind];
+    char *file1 = argv[optind + 1];
+    char *file2 = argv[optind + 2];
+    char *output = argc - optind > 3 ? argv[optind + 3] : NULL;
+
+    if ((strcmp(mode, "delta") == 0 || strcmp(mode, "patch") == 0) && !output) {
+        usage();
+        return 2;
     }
 
-    char *mode = argv[1];
-    char *file1 = argv[2];
-    char *file2 = argv[3];
+    // DIRECTORY DIFF: two trees instead of two files
+    if (strcmp(mode, "dir") == 0)
+        return dir_diff(file1, file2, threads) < 0 ? 1 : 0;
+
+    // Quick mode answers with its exit status alone, as cmp -s does
+    int quick = strcmp(mode, "quick") == 0;
 
     // Open files 
     int fd1 = open(file1, O_RDONLY);
@@ -92,14 +2359,21 @@ int main(int argc, char *argv[]) {
 
     if (fd1 < 0 || fd2 < 0) {
         perror("open"); //Error Handling for open
-        return 1;
+        return quick ? 2 : 1;
     }
 
     // Retrieve file size
     struct stat s1, s2;
-    if (stat(file1, &s1) < 0 || stat(file2, &s2) < 0) {
+    if (fstat(fd1, &s1) < 0 || fstat(fd2, &s2) < 0) {
         perror("stat"); //Error Handling for stat
-        return 1;
+        return quick ? 2 : 1;
+    }
+
+    if (quick) {
+        int status = quick_compare(fd1, fd2, &s1, &s2, threads);
+        close(fd1);
+        close(fd2);
+        return status;
     }
 
     // Performance timer start
@@ -108,13 +2382,23 @@ int main(int argc, char *argv[]) {
 
     // TEXT DIFF
     if (strcmp(mode, "text") == 0) {
-        text_diff(fd1, fd2);
+        if (text_diff(fd1, fd2, file1, file2) < 0) return 1;
     }
 
     // BINARY DIFF
     long diff = 0;
     if (strcmp(mode, "binary") == 0) {
-        diff = binary_diff(fd1, fd2, s1.st_size, s2.st_size);
+        diff = binary_diff(fd1, fd2, s1.st_size, s2.st_size, threads, max_ranges, hex,
+                           cache_path, cache_size);
+        if (diff < 0) return 1;
+    }
+
+    // DELTA / PATCH
+    if (strcmp(mode, "delta") == 0) {
+        if (delta_diff(fd1, fd2, s1.st_size, s2.st_size, output, block) < 0) return 1;
+    }
+    if (strcmp(mode, "patch") == 0) {
+        if (patch_apply(fd1, fd2, s1.st_size, s2.st_size, output) < 0) return 1;
     }
 
     // Performance timer end